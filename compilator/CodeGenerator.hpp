@@ -1,52 +1,59 @@
 #include <iostream>
 #include <vector>
 #include <unordered_map>
+#include <map>
+#include <set>
+#include <functional>
 #include <string>
 #include <stdexcept>
 
 #include "AstNode.hpp"
+#include "ControlFlowGraph.hpp"
+#include "Peephole.hpp"
+#include "LoopAnalysis.hpp"
+#include "ValueRange.hpp"
+#include "PartialEvaluator.hpp"
 
-class Instruction
+class CodeGeneratorError : public std::runtime_error
 {
 public:
-    std::string operation;
-    long long argument;
-    bool hasArgument;
-
-    Instruction(const std::string &op, long long arg = 0, bool hasArg = false)
-        : operation(op), argument(arg), hasArgument(hasArg) {}
-
-    void print() const
-    {
-        if (hasArgument)
-        {
-            std::cout << operation << " " << argument << std::endl;
-        }
-        else
-        {
-            std::cout << operation << std::endl;
-        }
-    }
+    CodeGeneratorError(const std::string &message, int line)
+        : std::runtime_error("Error at line " + std::to_string(line) + ": " + message) {}
 };
 
-class CodeGeneratorError : public std::runtime_error
+class Operand
 {
 public:
-    CodeGeneratorError(const std::string &message, int line)
-        : std::runtime_error("Error at line " + std::to_string(line) + ": " + message) {}
+    enum Kind
+    {
+        Constant,
+        Direct,
+        Indirect
+    };
+
+    Kind kind;
+    long long value;
+    bool temporary;
+
+    Operand(Kind operandKind, long long operandValue, bool isTemporary = false)
+        : kind(operandKind), value(operandValue), temporary(isTemporary) {}
 };
 
 class CodeGenerator
 {
 private:
+    ControlFlowGraph code;
+    PeepholeOptimizer peephole;
     std::vector<Instruction> instructions;
     std::unordered_map<std::string, long long> variableMemoryMap;
     std::unordered_map<std::string, std::pair<long long, long long>> arrayMemoryMap;
+    std::unordered_map<std::string, long long> arrayOffsets;
     std::unordered_map<std::string, long long> iteratorMemoryMap;
     std::unordered_map<std::string, long long> procedureEntryPoints;
     std::unordered_map<std::string, std::unordered_map<std::string, long long>> procedureArguments;
     std::unordered_map<std::string, std::unordered_map<std::string, long long>> procedureVariables;
     std::unordered_map<std::string, std::unordered_map<std::string, std::pair<long long, long long>>> procedureArrays;
+    std::unordered_map<std::string, std::unordered_map<std::string, long long>> procedureArrayOffsets;
     std::unordered_map<std::string, std::unordered_map<std::string, long long>> procedureArgumentsArrays;
     std::unordered_map<std::string, std::unordered_map<std::string, long long>> initializedVariables;
     std::vector<std::string> procedureCalls;
@@ -55,6 +62,71 @@ private:
     long long maxMemoryPointer = memoryPointer;
 
     std::unordered_map<std::string, std::unordered_map<std::string, bool>> procedureIterators;
+    std::map<std::pair<std::string, std::string>, long long> inductionPointers;
+    std::unordered_map<std::string, long long> hoistedValues;
+    std::unordered_map<std::string, long long> unrolledIterators;
+    long long unrollBudget = 160;
+    long long unrollMaxTrips = 64;
+    long long partialUnrollFactor = 4;
+    long long partialUnrollMaxSize = 16;
+
+    bool negatedArrayOffsets = false;
+    long long retiledExpressions = 0;
+
+    long long partialEvaluationFuel = 1000000;
+    long long partialEvaluationMaxCells = 4096;
+    long long evaluatedCommands = 0;
+    long long evaluatedSteps = 0;
+
+    const Profile *profile = nullptr;
+    long long profileHotIterations = 256;
+    long long profileUnrollScale = 4;
+
+    std::unordered_map<std::string, ProcedureNode *> procedureNodes;
+    std::unordered_map<std::string, long long> procedureCallCounts;
+    std::set<ProcedureCallNode *> callsInLoops;
+    long long inlinedCalls = 0;
+    long long inlineMaxSize = 60;
+    long long inlineLoopMaxSize = 200;
+    std::map<std::string, long long> procedureSizes;
+    long long programSize = 0;
+    long long codeGrowth = 0;
+    long long codeGrowthFactor = 4;
+    long long codeGrowthMinimum = 2000;
+    std::unordered_map<std::string, long long> procedureClones;
+    std::unordered_map<std::string, long long> procedureCloneCounts;
+    std::vector<std::pair<long long, std::pair<std::string, std::map<std::string, std::string>>>> pendingClones;
+    long long procedureCloneLimit = 4;
+    std::map<ProcedureCallNode *, std::pair<long long, long long>> preparedCalls;
+    long long preparedCallCount = 0;
+    std::unordered_map<std::string, std::set<std::string>> loopCompanions;
+    std::set<std::string> liveProcedures;
+    std::unordered_map<std::string, std::pair<long long, long long>> procedureFrames;
+    long long sharedFrameCells = 0;
+    std::set<std::string> aliasedProcedures;
+    long long copyLoopWeight = 8;
+    long long copyLoopPassWeight = 10;
+    std::unordered_map<std::string, std::unordered_map<std::string, long long>> copiedArguments;
+    long long copiedArgumentCount = 0;
+    std::unordered_map<std::string, std::pair<long long, std::set<std::string>>> availableValues;
+    std::vector<std::unordered_map<std::string, std::pair<long long, std::set<std::string>>>> loopValueStates;
+    long long reusedValues = 0;
+    std::unordered_map<std::string, ValueRange> knownRanges;
+    std::vector<std::unordered_map<std::string, ValueRange>> loopRangeStates;
+    std::vector<std::vector<std::unordered_map<std::string, ValueRange>>> ifArmRanges;
+    long long unsignedOperations = 0;
+    long long elidedGuards = 0;
+
+    long long arrayOffsetCellValue(long long offset) const
+    {
+        return negatedArrayOffsets ? -offset : offset;
+    }
+
+    void addArrayOffset(long long cell, bool throughPointer)
+    {
+        std::string operation = negatedArrayOffsets ? "SUB" : "ADD";
+        code.emit(throughPointer ? operation + "I" : operation, cell, true);
+    }
 
     void isInitialiazed(IdentifierNode *identifier)
     {
@@ -72,162 +144,191 @@ private:
         }
         generateExpression(identifier->index);
         long long baseAddress = getArrayElementAddress(*identifier->name);
-        instructions.emplace_back("ADD", baseAddress, true);
-        instructions.emplace_back("STORE", memoryPointer, true);
+        addArrayOffset(baseAddress, false);
+        code.emit("STORE", memoryPointer, true);
     }
 
-    void loadArrayValue(long long addressLocation)
+    void initializeResultAndSign(long long &resultTemp, long long &signTemp, bool withSign = true)
     {
-        instructions.emplace_back("LOADI", addressLocation, true);
-    }
+        code.emit("SET", 0, true);
+        code.emit("STORE", memoryPointer, true);
+        resultTemp = memoryPointer++;
 
-    void storeArrayValue(long long addressLocation)
-    {
-        instructions.emplace_back("STOREI", addressLocation, true);
+        if (withSign)
+        {
+            code.emit("SET", 1, true);
+            code.emit("STORE", memoryPointer, true);
+        }
+        signTemp = memoryPointer++;
     }
 
-    void handleArrayValues(bool isLeftArray, bool isRightArray, long long leftTemp, long long rightTemp, long long &leftValue, long long &rightValue)
+    bool handleOperandSigns(long long leftValue, long long rightValue, long long signTemp, bool leftNonNegative, bool rightNonNegative)
     {
-        leftValue = leftTemp;
-        rightValue = rightTemp;
-
-        if (isLeftArray)
+        if (leftNonNegative && rightNonNegative)
         {
-            loadArrayValue(leftTemp);
-            instructions.emplace_back("STORE", memoryPointer, true);
-            leftValue = memoryPointer++;
+            unsignedOperations++;
+            return false;
         }
-
-        if (isRightArray)
+        if (!leftNonNegative)
         {
-            loadArrayValue(rightTemp);
-            instructions.emplace_back("STORE", memoryPointer, true);
-            rightValue = memoryPointer++;
+            handleOperandSign(leftValue, signTemp, !rightNonNegative);
         }
-    }
-
-    void initializeResultAndSign(long long &resultTemp, long long &signTemp)
-    {
-        instructions.emplace_back("SET", 0, true);
-        instructions.emplace_back("STORE", memoryPointer, true);
-        resultTemp = memoryPointer++;
-
-        instructions.emplace_back("SET", 1, true);
-        instructions.emplace_back("STORE", memoryPointer, true);
-        signTemp = memoryPointer++;
+        if (!rightNonNegative)
+        {
+            handleOperandSign(rightValue, signTemp, false);
+        }
+        return true;
     }
 
     void handleOperandSign(long long value, long long signTemp, bool isFirst)
     {
-        instructions.emplace_back("SET", 0, true);
-        instructions.emplace_back("SUB", value, true);
+        long long negative = code.newLabel();
+        long long done = code.newLabel();
+
+        code.emit("SET", 0, true);
+        code.emit("SUB", value, true);
+        code.emitJump("JPOS", negative);
         if (isFirst)
         {
-            instructions.emplace_back("JPOS", 2, true);
-            instructions.emplace_back("JUMP", 4, true);
-            instructions.emplace_back("STORE", value, true);
-            instructions.emplace_back("SET", -1, true);
-            instructions.emplace_back("STORE", signTemp, true);
+            code.emitJump("JUMP", done);
+            code.placeLabel(negative);
+            code.emit("STORE", value, true);
+            code.emit("SET", -1, true);
+            code.emit("STORE", signTemp, true);
         }
         else
         {
-            instructions.emplace_back("JPOS", 5, true);
-            instructions.emplace_back("SET", 1, true);
-            instructions.emplace_back("ADD", signTemp, true);
-            instructions.emplace_back("STORE", signTemp, true);
-            instructions.emplace_back("JUMP", 5, true);
-            instructions.emplace_back("STORE", value, true);
-            instructions.emplace_back("SET", -1, true);
-            instructions.emplace_back("ADD", signTemp, true);
-            instructions.emplace_back("STORE", signTemp, true);
-        }
+            code.emit("SET", 1, true);
+            code.emit("ADD", signTemp, true);
+            code.emit("STORE", signTemp, true);
+            code.emitJump("JUMP", done);
+            code.placeLabel(negative);
+            code.emit("STORE", value, true);
+            code.emit("SET", -1, true);
+            code.emit("ADD", signTemp, true);
+            code.emit("STORE", signTemp, true);
+        }
+        code.placeLabel(done);
+    }
+
+    void swapOperandsBySize(long long leftValue, long long rightValue, long long resultTemp)
+    {
+        long long ordered = code.newLabel();
+
+        // resultTemp is still zero here, it holds leftValue - rightValue during the swap
+        code.emit("LOAD", leftValue, true);
+        code.emit("SUB", rightValue, true);
+        code.emitJump("JNEG", ordered);
+
+        code.emit("STORE", resultTemp, true);
+        code.emit("ADD", rightValue, true);
+        code.emit("STORE", rightValue, true);
+        code.emit("SUB", resultTemp, true);
+        code.emit("STORE", leftValue, true);
+        code.emit("SUB", 0, true);
+        code.emit("STORE", resultTemp, true);
+        code.placeLabel(ordered);
     }
 
     void performMultiplication(long long leftValue, long long rightValue, long long resultTemp)
     {
-        instructions.emplace_back("LOAD", leftValue, true);
-        instructions.emplace_back("JZERO", 15, true);
+        long long loop = code.newLabel();
+        long long even = code.newLabel();
+        long long end = code.newLabel();
 
-        instructions.emplace_back("HALF", 0, false);
-        instructions.emplace_back("ADD", 0, true);
-        instructions.emplace_back("SUB", leftValue, true);
-        instructions.emplace_back("JZERO", 4, true);
+        swapOperandsBySize(leftValue, rightValue, resultTemp);
 
-        instructions.emplace_back("LOAD", rightValue, true);
-        instructions.emplace_back("ADD", resultTemp, true);
-        instructions.emplace_back("STORE", resultTemp, true);
+        code.emit("LOAD", leftValue, true);
+        code.emitJump("JZERO", end);
 
-        instructions.emplace_back("LOAD", leftValue, true);
-        instructions.emplace_back("HALF", 0, false);
-        instructions.emplace_back("STORE", leftValue, true);
+        code.placeLabel(loop);
+        code.emit("HALF", 0, false);
+        code.emit("ADD", 0, true);
+        code.emit("SUB", leftValue, true);
+        code.emitJump("JZERO", even);
 
-        instructions.emplace_back("LOAD", rightValue, true);
-        instructions.emplace_back("ADD", rightValue, true);
-        instructions.emplace_back("STORE", rightValue, true);
+        code.emit("LOAD", resultTemp, true);
+        code.emit("ADD", rightValue, true);
+        code.emit("STORE", resultTemp, true);
 
-        instructions.emplace_back("JUMP", -15, true);
+        code.placeLabel(even);
+        code.emit("LOAD", rightValue, true);
+        code.emit("ADD", 0, true);
+        code.emit("STORE", rightValue, true);
+
+        code.emit("LOAD", leftValue, true);
+        code.emit("HALF", 0, false);
+        code.emit("STORE", leftValue, true);
+
+        code.emitJump("JPOS", loop);
+        code.placeLabel(end);
     }
 
     void applySign(long long resultTemp, long long signTemp)
     {
-        instructions.emplace_back("LOAD", signTemp, true);
-        instructions.emplace_back("JZERO", 3, true);
-        instructions.emplace_back("LOAD", resultTemp, true);
-        instructions.emplace_back("JUMP", 3, true);
-        instructions.emplace_back("SET", 0, true);
-        instructions.emplace_back("SUB", resultTemp, true);
+        long long negative = code.newLabel();
+        long long done = code.newLabel();
+
+        code.emit("LOAD", signTemp, true);
+        code.emitJump("JZERO", negative);
+        code.emit("LOAD", resultTemp, true);
+        code.emitJump("JUMP", done);
+        code.placeLabel(negative);
+        code.emit("SET", 0, true);
+        code.emit("SUB", resultTemp, true);
+        code.placeLabel(done);
     }
 
     void performDivision(long long leftValue, long long rightValue, long long resultTemp)
     {
-        instructions.emplace_back("LOAD", rightValue, true);
-        instructions.emplace_back("STORE", memoryPointer, true);
+        long long doubling = code.newLabel();
+        long long halving = code.newLabel();
+        long long step = code.newLabel();
+        long long quotientZero = code.newLabel();
+        long long quotientStore = code.newLabel();
+        long long end = code.newLabel();
+
+        code.emit("LOAD", rightValue, true);
+        code.emit("STORE", memoryPointer, true);
         long long currentDivisor = memoryPointer++;
 
-        instructions.emplace_back("SET", 1, true);
-        instructions.emplace_back("STORE", memoryPointer, true);
-        long long currentQuotient = memoryPointer++;
-
-        instructions.emplace_back("LOAD", leftValue, true);
-        instructions.emplace_back("SUB", currentDivisor, true);
-        instructions.emplace_back("JNEG", 8, true);
-
-        instructions.emplace_back("LOAD", currentDivisor, true);
-        instructions.emplace_back("ADD", currentDivisor, true);
-        instructions.emplace_back("STORE", currentDivisor, true);
-
-        instructions.emplace_back("LOAD", currentQuotient, true);
-        instructions.emplace_back("ADD", currentQuotient, true);
-        instructions.emplace_back("STORE", currentQuotient, true);
-
-        instructions.emplace_back("JUMP", -9, true);
-
-        instructions.emplace_back("LOAD", currentDivisor, true);
-        instructions.emplace_back("HALF", 0, false);
-        instructions.emplace_back("STORE", currentDivisor, true);
-
-        instructions.emplace_back("LOAD", currentQuotient, true);
-        instructions.emplace_back("HALF", 0, false);
-        instructions.emplace_back("STORE", currentQuotient, true);
-
-        instructions.emplace_back("LOAD", leftValue, true);
-        instructions.emplace_back("SUB", currentDivisor, true);
-        instructions.emplace_back("STORE", leftValue, true);
-
-        instructions.emplace_back("LOAD", resultTemp, true);
-        instructions.emplace_back("ADD", currentQuotient, true);
-        instructions.emplace_back("STORE", resultTemp, true);
-
-        instructions.emplace_back("LOAD", rightValue, true);
-        instructions.emplace_back("STORE", currentDivisor, true);
-
-        instructions.emplace_back("SET", 1, true);
-        instructions.emplace_back("STORE", currentQuotient, true);
-
-        instructions.emplace_back("LOAD", leftValue, true);
-        instructions.emplace_back("SUB", currentDivisor, true);
-        instructions.emplace_back("JNEG", 2, true);
-        instructions.emplace_back("JUMP", -33, true);
+        code.placeLabel(doubling);
+        code.emit("ADD", 0, true);
+        code.emit("SUB", leftValue, true);
+        code.emitJump("JPOS", halving);
+        code.emit("ADD", leftValue, true);
+        code.emit("STORE", currentDivisor, true);
+        code.emitJump("JUMP", doubling);
+
+        code.placeLabel(halving);
+        code.emit("SET", 1, true);
+        code.emit("STORE", memoryPointer, true);
+        long long one = memoryPointer++;
+
+        code.placeLabel(step);
+        code.emit("LOAD", leftValue, true);
+        code.emit("SUB", currentDivisor, true);
+        code.emitJump("JNEG", quotientZero);
+
+        code.emit("STORE", leftValue, true);
+        code.emit("LOAD", resultTemp, true);
+        code.emit("ADD", resultTemp, true);
+        code.emit("ADD", one, true);
+        code.emitJump("JUMP", quotientStore);
+
+        code.placeLabel(quotientZero);
+        code.emit("LOAD", resultTemp, true);
+        code.emit("ADD", resultTemp, true);
+        code.placeLabel(quotientStore);
+        code.emit("STORE", resultTemp, true);
+
+        code.emit("LOAD", currentDivisor, true);
+        code.emit("HALF", 0, false);
+        code.emit("STORE", currentDivisor, true);
+        code.emit("SUB", rightValue, true);
+        code.emitJump("JNEG", end);
+        code.emitJump("JUMP", step);
+        code.placeLabel(end);
     }
 
     void allocateIterator(const std::string &name)
@@ -321,9 +422,11 @@ private:
             throw std::runtime_error("Invalid array range: start > end");
         }
         long long size = end - start + 1;
-        instructions.emplace_back("SET", memoryPointer - start, true);
+        procedureArrayOffsets[procedureName][variableName] = memoryPointer - start;
+        code.emit("SET", arrayOffsetCellValue(memoryPointer - start), true);
+        code.exposeRange(memoryPointer, memoryPointer + size - 1);
         memoryPointer += size;
-        instructions.emplace_back("STORE", memoryPointer, true);
+        code.emit("STORE", memoryPointer, true);
         procedureArrays[procedureName][variableName] = {memoryPointer, size};
         memoryPointer++;
     }
@@ -406,7 +509,7 @@ private:
         {
 
             auto varIt = argIt->second.find(name);
-            if (varIt != argIt->second.end())
+            if (varIt != argIt->second.end() && !isCopiedArgument(currentProcedure, name))
             {
                 return 1;
             }
@@ -475,6 +578,24 @@ private:
         return arrIt->second.first;
     }
 
+    long long getProcedureArrayOffset(const std::string &name) const
+    {
+        const std::string &currentProcedure = procedureCalls.back();
+        auto procIt = procedureArrayOffsets.find(currentProcedure);
+        if (procIt == procedureArrayOffsets.end())
+        {
+            throw std::runtime_error("Procedure not found: " + currentProcedure);
+        }
+
+        auto arrIt = procIt->second.find(name);
+        if (arrIt == procIt->second.end())
+        {
+            throw std::runtime_error("Array not found in procedure " + currentProcedure + ": " + name);
+        }
+
+        return arrIt->second;
+    }
+
     long long getProcedureArgumentArrayElementAddress(const std::string &name) const
     {
         const std::string &currentProcedure = procedureCalls.back();
@@ -501,8 +622,8 @@ private:
         }
         generateExpression(identifier->index);
         long long baseAddress = getProcedureArrayElementAddress(*identifier->name);
-        instructions.emplace_back("ADD", baseAddress, true);
-        instructions.emplace_back("STORE", memoryPointer, true);
+        addArrayOffset(baseAddress, false);
+        code.emit("STORE", memoryPointer, true);
         return memoryPointer;
     }
 
@@ -514,12 +635,15 @@ private:
         }
         generateExpression(identifier->index);
         long long baseAddress = getProcedureArgumentArrayElementAddress(*identifier->name);
-        instructions.emplace_back("ADDI", baseAddress, true);
-        instructions.emplace_back("STORE", memoryPointer, true);
+        addArrayOffset(baseAddress, true);
+        code.emit("STORE", memoryPointer, true);
         return memoryPointer;
     }
 
 public:
+    CodeGenerator() = default;
+    explicit CodeGenerator(const Profile *executionProfile) : profile(executionProfile) {}
+
     void generateProgram(ProgramNode *programNode)
     {
         try
@@ -530,27 +654,37 @@ public:
             }
 
             procedureCalls.emplace_back("main");
+            collectCallSites(programNode);
+            collectAliasedProcedures(programNode);
+            negatedArrayOffsets = instructionCost("SUBI") < instructionCost("ADDI") && takesArrayArguments(programNode->procedures);
 
-            long long jumpToMain;
+            long long mainLabel = code.newLabel();
             if (programNode->procedures)
             {
-                instructions.emplace_back("JUMP", 0, true);
-                jumpToMain = instructions.size() - 1;
+                code.emitJump("JUMP", mainLabel);
                 generateProcedures(programNode->procedures);
             }
 
             if (programNode->main)
             {
                 memoryPointer = std::max(memoryPointer, maxMemoryPointer);
-                if (programNode->procedures)
-                {
-                    instructions[jumpToMain].argument = instructions.size() - jumpToMain;
-                }
-                generateMain(programNode->main);
+                code.enterOrigin(programNode->main);
+                code.placeLabel(mainLabel);
+                generateMain(programNode->main, programNode->procedures);
+                code.leaveOrigin();
                 procedureCalls.pop_back();
             }
 
-            instructions.emplace_back("HALT");
+            code.emit("HALT");
+            generateProcedureClones();
+            code.removeUnreachableBlocks();
+            code.poolConstantLoads(profile);
+            code.allocateConstants(std::max({memoryPointer, maxMemoryPointer, code.highestAddress()}) + 1);
+            code.removeRedundantInstructions();
+            code.removeDeadStores();
+            peephole.run(code);
+            code.layoutBlocks(profile);
+            instructions = code.assemble();
         }
         catch (const CodeGeneratorError &e)
         {
@@ -558,13 +692,307 @@ public:
         }
     }
 
+    static bool takesArrayArguments(ProceduresNode *procedures)
+    {
+        if (!procedures)
+        {
+            return false;
+        }
+        for (auto procedure : procedures->procedures)
+        {
+            if (!procedure->arguments->argumentsDeclaration)
+            {
+                continue;
+            }
+            for (auto argument : procedure->arguments->argumentsDeclaration->args)
+            {
+                if (argument->isArray)
+                {
+                    return true;
+                }
+            }
+        }
+        return false;
+    }
+
+    void collectCallSites(ProgramNode *programNode)
+    {
+        auto visit = [&](ProcedureCallNode *call, bool inLoop)
+        {
+            procedureCallCounts[*call->procedureName]++;
+            if (inLoop)
+            {
+                callsInLoops.insert(call);
+            }
+        };
+        auto companions = [&](CommandsNode *loop)
+        {
+            std::set<std::string> called;
+            LoopAnalysis::forEachCall(loop, [&](ProcedureCallNode *call, bool)
+                                      { called.insert(*call->procedureName); });
+            for (const auto &name : called)
+            {
+                loopCompanions[name].insert(called.begin(), called.end());
+                loopCompanions[name].erase(name);
+            }
+        };
+
+        if (programNode->procedures)
+        {
+            for (auto procedure : programNode->procedures->procedures)
+            {
+                if (procedure && procedure->arguments && procedure->commands)
+                {
+                    procedureNodes[*procedure->arguments->procedureName] = procedure;
+                    procedureSizes[*procedure->arguments->procedureName] = LoopAnalysis::estimateSize(procedure->commands, procedureSizes);
+                    programSize += LoopAnalysis::estimateSize(procedure->commands);
+                    LoopAnalysis::forEachCall(procedure->commands, visit);
+                    LoopAnalysis::forEachLoop(procedure->commands, companions);
+                }
+            }
+        }
+        if (programNode->main && programNode->main->commands)
+        {
+            programSize += LoopAnalysis::estimateSize(programNode->main->commands);
+            LoopAnalysis::forEachCall(programNode->main->commands, visit);
+            LoopAnalysis::forEachLoop(programNode->main->commands, companions);
+            LoopAnalysis::forEachCall(programNode->main->commands, [&](ProcedureCallNode *call, bool)
+                                      { markProcedureLive(*call->procedureName); });
+        }
+    }
+
+    void markProcedureLive(const std::string &name)
+    {
+        auto procedure = procedureNodes.find(name);
+        if (procedure == procedureNodes.end() || !liveProcedures.insert(name).second)
+        {
+            return;
+        }
+        LoopAnalysis::forEachCall(procedure->second->commands, [&](ProcedureCallNode *call, bool)
+                                  { markProcedureLive(*call->procedureName); });
+    }
+
     void generateProcedures(ProceduresNode *proceduresNode)
     {
+        std::set<std::string> persistentFrames;
         for (const auto &procedure : proceduresNode->procedures)
         {
+            if (procedure && procedure->arguments && procedure->commands && LoopAnalysis::keepsLocalsBetweenCalls(procedure))
+            {
+                persistentFrames.insert(*procedure->arguments->procedureName);
+            }
+        }
+
+        long long frameCells = 0;
+        long long highestFrameEnd = memoryPointer;
+        for (const auto &procedure : proceduresNode->procedures)
+        {
+            if (!procedure || !procedure->arguments || !procedure->commands)
+            {
+                continue;
+            }
+
+            const std::string &name = *procedure->arguments->procedureName;
+            long long frameStart = 1;
+            for (const auto &[placed, frame] : procedureFrames)
+            {
+                if (liveProcedures.count(name) && !liveProcedures.count(placed))
+                {
+                    continue;
+                }
+                bool live = persistentFrames.count(name) || persistentFrames.count(placed) || reachesProcedure(name, placed);
+                for (const auto &companion : loopCompanions[name])
+                {
+                    live = live || companion == placed || reachesProcedure(companion, placed);
+                }
+                if (live)
+                {
+                    frameStart = std::max(frameStart, frame.second);
+                }
+            }
+
+            long long highestBefore = maxMemoryPointer;
+            memoryPointer = frameStart;
+            maxMemoryPointer = frameStart;
             generateProcedure(procedure);
-            memoryPointer = maxMemoryPointer >= memoryPointer ? maxMemoryPointer + 1 : memoryPointer;
+            long long frameEnd = std::max(maxMemoryPointer, memoryPointer) + 1;
+
+            procedureFrames[name] = {frameStart, frameEnd};
+            maxMemoryPointer = highestBefore;
+            if (liveProcedures.count(name))
+            {
+                frameCells += frameEnd - frameStart;
+                highestFrameEnd = std::max(highestFrameEnd, frameEnd);
+                maxMemoryPointer = std::max(highestBefore, frameEnd - 1);
+            }
+        }
+        memoryPointer = highestFrameEnd;
+        sharedFrameCells = frameCells - (highestFrameEnd - 1);
+    }
+
+    bool isCopiedArgument(const std::string &procedure, const std::string &name) const
+    {
+        auto copied = copiedArguments.find(procedure);
+        return copied != copiedArguments.end() && copied->second.count(name);
+    }
+
+    bool isScalarArgument(const std::string &procedure, const std::string &name) const
+    {
+        auto found = procedureNodes.find(procedure);
+        if (found == procedureNodes.end() || !found->second->arguments->argumentsDeclaration)
+        {
+            return false;
+        }
+        for (auto argument : found->second->arguments->argumentsDeclaration->args)
+        {
+            if (*argument->argumentName == name)
+            {
+                return !argument->isArray;
+            }
+        }
+        return false;
+    }
+
+    void collectAliasedProcedures(ProgramNode *programNode)
+    {
+        std::vector<std::pair<std::string, ProcedureCallNode *>> sites;
+        for (const auto &[name, procedure] : procedureNodes)
+        {
+            LoopAnalysis::forEachCall(procedure->commands, [&, caller = name](ProcedureCallNode *call, bool)
+                                      { sites.emplace_back(caller, call); });
+        }
+        if (programNode->main && programNode->main->commands)
+        {
+            LoopAnalysis::forEachCall(programNode->main->commands, [&](ProcedureCallNode *call, bool)
+                                      { sites.emplace_back("main", call); });
+        }
+
+        bool changed = true;
+        while (changed)
+        {
+            changed = false;
+            for (const auto &[caller, call] : sites)
+            {
+                const std::string &callee = *call->procedureName;
+                if (aliasedProcedures.count(callee) || !call->arguments)
+                {
+                    continue;
+                }
+                auto found = procedureNodes.find(callee);
+                auto declared = found == procedureNodes.end() ? nullptr : found->second->arguments->argumentsDeclaration;
+                std::set<std::string> passed;
+                long long passedArguments = 0;
+                bool aliased = false;
+                for (size_t i = 0; i < call->arguments->arguments.size(); ++i)
+                {
+                    auto identifier = dynamic_cast<IdentifierNode *>(call->arguments->arguments[i]);
+                    if (!identifier || (declared && i < declared->args.size() && declared->args[i]->isArray))
+                    {
+                        continue;
+                    }
+                    aliased = aliased || !passed.insert(*identifier->name).second;
+                    passedArguments += isScalarArgument(caller, *identifier->name);
+                }
+                if (aliased || (passedArguments > 1 && aliasedProcedures.count(caller)))
+                {
+                    aliasedProcedures.insert(callee);
+                    changed = true;
+                }
+            }
+        }
+    }
+
+    long long copySavings(ProcedureNode *procedure, const std::string &name) const
+    {
+        long long uses = 0;
+        auto count = [&](IdentifierNode *identifier)
+        {
+            uses += *identifier->name == name;
+        };
+        LoopAnalysis::forEachIdentifier(procedure->commands, count);
+        LoopAnalysis::forEachLoop(procedure->commands, [&](CommandsNode *loop)
+                                  {
+            long long before = uses;
+            LoopAnalysis::forEachIdentifier(loop, count);
+            uses += (uses - before) * copyLoopWeight; });
+
+        long long passed = 0;
+        LoopAnalysis::forEachCall(procedure->commands, [&](ProcedureCallNode *call, bool inLoop)
+                                  {
+            for (auto argument : call->arguments->arguments)
+            {
+                auto identifier = dynamic_cast<IdentifierNode *>(argument);
+                passed += identifier && *identifier->name == name ? (inLoop ? copyLoopPassWeight : 1) : 0;
+            } });
+
+        return (uses - passed) * (instructionCost("LOADI") - instructionCost("LOAD")) -
+               passed * (instructionCost("SET") - instructionCost("LOAD"));
+    }
+
+    void copyArgumentsIn(ProcedureNode *procedure)
+    {
+        const std::string &name = *procedure->arguments->procedureName;
+        if (aliasedProcedures.count(name) || !procedure->arguments->argumentsDeclaration)
+        {
+            return;
+        }
+
+        LoopWrites writes;
+        LoopAnalysis::collectWrites(procedure->commands, writes);
+        for (auto argument : procedure->arguments->argumentsDeclaration->args)
+        {
+            const std::string &parameter = *argument->argumentName;
+            long long copyCost = instructionCost("LOADI") + instructionCost("STORE");
+            if (writes.scalars.count(parameter))
+            {
+                copyCost += instructionCost("LOAD") + instructionCost("STOREI");
+            }
+            if (argument->isArray || copySavings(procedure, parameter) <= copyCost)
+            {
+                continue;
+            }
+
+            long long pointer = procedureArguments[name][parameter];
+            long long local = memoryPointer++;
+            procedureVariables[name][parameter] = local;
+            copiedArguments[name][parameter] = pointer;
+            code.emit("LOADI", pointer, true);
+            code.emit("STORE", local, true);
+            copiedArgumentCount++;
+        }
+    }
+
+    void copyArgumentsOut(ProcedureNode *procedure)
+    {
+        const std::string &name = *procedure->arguments->procedureName;
+        LoopWrites writes;
+        LoopAnalysis::collectWrites(procedure->commands, writes);
+        for (const auto &[parameter, pointer] : copiedArguments[name])
+        {
+            if (writes.scalars.count(parameter))
+            {
+                code.emit("LOAD", procedureVariables[name][parameter], true);
+                code.emit("STOREI", pointer, true);
+            }
+        }
+    }
+
+    bool framesCollide(const std::string &from, const std::string &target)
+    {
+        auto frame = procedureFrames.find(from);
+        auto other = procedureFrames.find(target);
+        if (frame == procedureFrames.end() || other == procedureFrames.end())
+        {
+            return false;
+        }
+        if (from != target && frame->second.first < other->second.second && other->second.first < frame->second.second)
+        {
+            return true;
         }
+        bool collides = false;
+        LoopAnalysis::forEachCall(procedureNodes[from]->commands, [&](ProcedureCallNode *call, bool)
+                                  { collides = collides || framesCollide(*call->procedureName, target); });
+        return collides;
     }
 
     void generateProcedure(ProcedureNode *procedureNode)
@@ -572,7 +1000,10 @@ public:
         if (!procedureNode || !procedureNode->commands)
             return;
 
-        procedureEntryPoints[*procedureNode->arguments->procedureName] = instructions.size();
+        long long entryLabel = code.newLabel();
+        procedureEntryPoints[*procedureNode->arguments->procedureName] = entryLabel;
+        code.enterOrigin(procedureNode);
+        code.placeLabel(entryLabel);
 
         generateProcedureHead(procedureNode->arguments);
 
@@ -584,10 +1015,15 @@ public:
         allocateReturnVariable(*procedureNode->arguments->procedureName);
 
         procedureCalls.emplace_back(*procedureNode->arguments->procedureName);
+        availableValues.clear();
+        knownRanges.clear();
+        copyArgumentsIn(procedureNode);
         generateCommands(procedureNode->commands);
+        copyArgumentsOut(procedureNode);
         procedureCalls.pop_back();
 
-        instructions.emplace_back("RTRN", procedureVariables[*procedureNode->arguments->procedureName]["return"], true);
+        code.emit("RTRN", procedureVariables[*procedureNode->arguments->procedureName]["return"], true);
+        code.leaveOrigin();
     }
 
     void generateProcedureHead(ProcedureHeadNode *procedureHead)
@@ -652,7 +1088,7 @@ public:
         }
     }
 
-    void generateMain(MainNode *mainNode)
+    void generateMain(MainNode *mainNode, ProceduresNode *proceduresNode)
     {
         if (mainNode->declarations)
         {
@@ -660,8 +1096,66 @@ public:
         }
         if (mainNode->commands)
         {
-            generateCommands(mainNode->commands);
+            generateCommands(mainNode->commands, evaluateInputFreePrefix(mainNode, proceduresNode));
+        }
+    }
+
+    size_t evaluateInputFreePrefix(MainNode *mainNode, ProceduresNode *proceduresNode)
+    {
+        PartialEvaluator evaluator(proceduresNode, partialEvaluationFuel, partialEvaluationMaxCells);
+        EvaluatedPrefix prefix = evaluator.run(mainNode);
+        if (prefix.commands == 0)
+        {
+            return 0;
+        }
+
+        for (auto value : prefix.outputs)
+        {
+            code.emit("PUT", code.constantCell(value), true);
+        }
+
+        std::set<std::string> residueNames;
+        for (size_t position = prefix.commands; position < mainNode->commands->commands.size(); ++position)
+        {
+            LoopAnalysis::forEachIdentifier(mainNode->commands->commands[position], [&](IdentifierNode *identifier)
+                                            { residueNames.insert(*identifier->name); });
+        }
+
+        std::map<long long, std::vector<long long>> cellsByValue;
+        for (const auto &[name, value] : prefix.scalars)
+        {
+            if (residueNames.count(name))
+            {
+                cellsByValue[value].push_back(getVariableMemoryAddress(name));
+                knownRanges[name] = ValueRange::constant(value);
+            }
+        }
+        for (const auto &[name, elements] : prefix.arrays)
+        {
+            for (const auto &[index, value] : elements)
+            {
+                if (residueNames.count(name))
+                {
+                    cellsByValue[value].push_back(getArrayOffset(name) + index);
+                }
+            }
+        }
+        for (const auto &[value, cells] : cellsByValue)
+        {
+            code.emit("SET", value, true);
+            for (auto cell : cells)
+            {
+                code.emit("STORE", cell, true);
+            }
+        }
+        for (const auto &name : prefix.initialized)
+        {
+            initializedVariables["main"][name] = true;
         }
+
+        evaluatedCommands += prefix.commands;
+        evaluatedSteps += prefix.steps;
+        return prefix.commands;
     }
 
     void generateDeclarations(DeclarationsNode *declarationsNode)
@@ -686,10 +1180,28 @@ public:
         }
     }
 
-    void generateCommands(CommandsNode *commandsNode)
+    void generateCommands(CommandsNode *commandsNode, size_t first = 0)
     {
-        for (const auto &command : commandsNode->commands)
-        {
+        for (size_t position = first; position < commandsNode->commands.size(); ++position)
+        {
+            CommandNode *command = commandsNode->commands[position];
+            auto valid = valuesSurviving(command);
+            auto ranges = rangesSurviving(command);
+            auto entryRanges = knownRanges;
+            auto assignment = dynamic_cast<AssignNode *>(command);
+            ValueRange assigned = assignment ? rangeOf(assignment->expression) : ValueRange();
+            bool loop = dynamic_cast<WhileNode *>(command) || dynamic_cast<RepeatUntilNode *>(command) ||
+                        dynamic_cast<ForToNode *>(command) || dynamic_cast<ForDownToNode *>(command);
+            if (loop)
+            {
+                availableValues = valid;
+                loopValueStates.push_back(valid);
+                knownRanges = ranges;
+                loopRangeStates.push_back(ranges);
+            }
+            ifArmRanges.emplace_back();
+            code.enterOrigin(command);
+
             if (auto ifNode = dynamic_cast<IfNode *>(command))
             {
                 generateIfCommand(ifNode);
@@ -730,43 +1242,350 @@ public:
             {
                 throw std::runtime_error("Unsupported command type in CommandsNode.");
             }
-        }
-    }
+            code.leaveOrigin();
 
-    void generateProcedureCallArguments(const std::string &procedureName, ProcedureCallArguments *arguments)
-    {
-        try
-        {
-            if (arguments->arguments.size() != argumentsPlaces[procedureName].size())
+            if (loop)
             {
-                throw std::runtime_error("Argument count mismatch for procedure " + procedureName + ": expected " + std::to_string(argumentsPlaces[procedureName].size()) + " but got " + std::to_string(arguments->arguments.size()));
+                loopValueStates.pop_back();
+                loopRangeStates.pop_back();
             }
-            for (size_t i = 1; i <= arguments->arguments.size(); ++i)
+            availableValues = valid;
+            knownRanges = ranges;
+            if (assignment)
             {
-                const auto &arg = arguments->arguments[i - 1];
-                const auto &expectedArg = argumentsPlaces[procedureName][i];
+                recordValue(assignment);
+                recordRange(assignment, assigned);
+            }
 
-                if (auto identifier = dynamic_cast<IdentifierNode *>(arg))
+            auto arms = ifArmRanges.back();
+            ifArmRanges.pop_back();
+            if (auto ifNode = dynamic_cast<IfNode *>(command))
+            {
+                if (!ifNode->elseCommands)
                 {
-                    std::string procedureRemember = procedureCalls.back();
-                    procedureCalls.pop_back();
-                    auto sign = getProcedureIdentifierAddress(*identifier->name);
-                    procedureCalls.emplace_back(procedureRemember);
-                    if (sign != -1)
-                    {
-                        if (sign == 1)
-                        {
-                            if (expectedArg.second)
-                            {
-                                throw std::runtime_error("Argument type mismatch for procedure " + procedureName + ": expected " + (expectedArg.second ? "array" : "variable") + " but got " + (identifier->isArrayRange ? "array" : "variable"));
-                            }
-                            std::string procedureRemember = procedureCalls.back();
-                            procedureCalls.pop_back();
+                    arms.push_back(entryRanges);
+                }
+                knownRanges = joinRanges(arms);
+            }
+            else if (auto whileNode = dynamic_cast<WhileNode *>(command))
+            {
+                refineRanges(whileNode->condition, false);
+            }
+            else if (auto repeatNode = dynamic_cast<RepeatUntilNode *>(command))
+            {
+                refineRanges(repeatNode->condition, true);
+            }
+        }
+    }
+
+    void refineRanges(ConditionNode *condition, bool holds)
+    {
+        if (!condition)
+        {
+            return;
+        }
+        std::string operation = condition->operation;
+        if (!holds)
+        {
+            static const std::map<std::string, std::string> negated = {
+                {"=", "!="}, {"!=", "="}, {"<", ">="}, {">=", "<"}, {">", "<="}, {"<=", ">"}};
+            operation = negated.at(operation);
+        }
+        refineRange(condition->leftValue, operation, rangeOf(condition->rightValue));
+        refineRange(condition->rightValue, mirrorComparison(operation), rangeOf(condition->leftValue));
+    }
+
+    void refineRange(ExpressionNode *node, const std::string &operation, const ValueRange &bound)
+    {
+        auto identifier = dynamic_cast<IdentifierNode *>(node);
+        if (!identifier || identifier->index || unrolledIterators.count(*identifier->name))
+        {
+            return;
+        }
+        ValueRange range = rangeOf(identifier);
+        if (operation == "=")
+        {
+            range = range.intersect(bound);
+        }
+        else if (operation == "!=" && bound.low == bound.high)
+        {
+            if (range.low == bound.low && range.low != LLONG_MAX)
+            {
+                range.low++;
+            }
+            if (range.high == bound.high && range.high != LLONG_MIN)
+            {
+                range.high--;
+            }
+        }
+        else if (operation == "<")
+        {
+            range.high = std::min(range.high, bound.high == LLONG_MAX ? LLONG_MAX : bound.high - 1);
+        }
+        else if (operation == "<=")
+        {
+            range.high = std::min(range.high, bound.high);
+        }
+        else if (operation == ">")
+        {
+            range.low = std::max(range.low, bound.low == LLONG_MIN ? LLONG_MIN : bound.low + 1);
+        }
+        else if (operation == ">=")
+        {
+            range.low = std::max(range.low, bound.low);
+        }
+        if (range.empty())
+        {
+            range = ValueRange::bottom();
+        }
+        if (range.low != LLONG_MIN || range.high != LLONG_MAX)
+        {
+            knownRanges[*identifier->name] = range;
+        }
+    }
+
+    std::unordered_map<std::string, ValueRange> joinRanges(const std::vector<std::unordered_map<std::string, ValueRange>> &arms) const
+    {
+        std::unordered_map<std::string, ValueRange> joined;
+        if (arms.empty())
+        {
+            return joined;
+        }
+        for (const auto &[name, range] : arms.front())
+        {
+            ValueRange hull = range;
+            bool everywhere = true;
+            for (const auto &arm : arms)
+            {
+                auto found = arm.find(name);
+                everywhere = everywhere && found != arm.end();
+                if (found != arm.end())
+                {
+                    hull = hull.hull(found->second);
+                }
+            }
+            if (everywhere)
+            {
+                joined[name] = hull;
+            }
+        }
+        return joined;
+    }
+
+    std::unordered_map<std::string, ValueRange> rangesSurviving(AstNode *command)
+    {
+        bool calls = false;
+        LoopAnalysis::forEachCall(command, [&](ProcedureCallNode *, bool)
+                                  { calls = true; });
+        LoopWrites writes = collectLoopWrites({command}, "");
+        auto surviving = knownRanges;
+        for (auto it = surviving.begin(); it != surviving.end();)
+        {
+            bool written = writes.scalars.count(it->first) || (calls && it->first.find('@') != std::string::npos);
+            it = written ? surviving.erase(it) : std::next(it);
+        }
+        return surviving;
+    }
+
+    void recordRange(AssignNode *assignNode, const ValueRange &range)
+    {
+        auto target = dynamic_cast<IdentifierNode *>(assignNode->identifier);
+        if (target && !target->index && (range.low != LLONG_MIN || range.high != LLONG_MAX))
+        {
+            knownRanges[*target->name] = range;
+        }
+    }
+
+    ValueRange rangeOf(ExpressionNode *node) const
+    {
+        if (auto value = dynamic_cast<ValueNode *>(node))
+        {
+            return ValueRange::constant(value->value);
+        }
+        if (auto identifier = dynamic_cast<IdentifierNode *>(node))
+        {
+            if (identifier->index)
+            {
+                return ValueRange();
+            }
+            auto unrolled = unrolledIterators.find(*identifier->name);
+            if (unrolled != unrolledIterators.end())
+            {
+                return ValueRange::constant(unrolled->second);
+            }
+            auto known = knownRanges.find(*identifier->name);
+            return known != knownRanges.end() ? known->second : ValueRange();
+        }
+        if (auto binary = dynamic_cast<BinaryExpressionNode *>(node))
+        {
+            ValueRange left = rangeOf(binary->left);
+            ValueRange right = rangeOf(binary->right);
+            if (binary->operation == "+")
+            {
+                return ValueRange::add(left, right);
+            }
+            if (binary->operation == "-")
+            {
+                return ValueRange::subtract(left, right);
+            }
+            if (binary->operation == "*")
+            {
+                return ValueRange::multiply(left, right);
+            }
+            if (binary->operation == "/")
+            {
+                return ValueRange::divide(left, right);
+            }
+            if (binary->operation == "%")
+            {
+                return ValueRange::modulo(left, right);
+            }
+        }
+        return ValueRange();
+    }
+
+    void generateLoopBody(CommandsNode *commands, ConditionNode *condition = nullptr)
+    {
+        availableValues = loopValueStates.back();
+        knownRanges = loopRangeStates.back();
+        refineRanges(condition, true);
+        code.enterLoop();
+        generateCommands(commands);
+        code.leaveLoop();
+        availableValues = loopValueStates.back();
+        knownRanges = loopRangeStates.back();
+    }
+
+    void generateIfArm(IfNode *ifNode, bool taken)
+    {
+        auto entry = availableValues;
+        auto entryRanges = knownRanges;
+        refineRanges(ifNode->condition, taken);
+        bool reachable = std::none_of(knownRanges.begin(), knownRanges.end(), [](const auto &known)
+                                      { return known.second.empty(); });
+        generateCommands(taken ? ifNode->thenCommands : ifNode->elseCommands);
+        if (reachable)
+        {
+            ifArmRanges.back().push_back(knownRanges);
+        }
+        availableValues = entry;
+        knownRanges = entryRanges;
+    }
+
+    std::string valueKey(ExpressionNode *node) const
+    {
+        auto binary = dynamic_cast<BinaryExpressionNode *>(node);
+        if (!binary || (binary->operation != "*" && binary->operation != "/" && binary->operation != "%"))
+        {
+            return "";
+        }
+        std::string left = expressionKey(binary->left);
+        std::string right = expressionKey(binary->right);
+        if (binary->operation == "*" && right < left)
+        {
+            std::swap(left, right);
+        }
+        return left + binary->operation + right;
+    }
+
+    std::unordered_map<std::string, std::pair<long long, std::set<std::string>>> valuesSurviving(AstNode *command)
+    {
+        bool calls = false;
+        LoopAnalysis::forEachCall(command, [&](ProcedureCallNode *, bool)
+                                  { calls = true; });
+        if (calls)
+        {
+            return {};
+        }
+
+        LoopWrites writes = collectLoopWrites({command}, "");
+        auto surviving = availableValues;
+        for (auto it = surviving.begin(); it != surviving.end();)
+        {
+            bool written = false;
+            for (const auto &name : it->second.second)
+            {
+                written = written || writes.scalars.count(name);
+            }
+            it = written ? surviving.erase(it) : std::next(it);
+        }
+        return surviving;
+    }
+
+    void recordValue(AssignNode *assignNode)
+    {
+        auto target = dynamic_cast<IdentifierNode *>(assignNode->identifier);
+        std::string key = valueKey(assignNode->expression);
+        if (!target || target->index || key.empty() || iteratorMemoryMap.count(*target->name))
+        {
+            return;
+        }
+
+        auto binary = dynamic_cast<BinaryExpressionNode *>(assignNode->expression);
+        std::set<std::string> names = {*target->name};
+        for (auto operand : {binary->left, binary->right})
+        {
+            if (auto identifier = dynamic_cast<IdentifierNode *>(operand))
+            {
+                if (identifier->index || *identifier->name == *target->name || iteratorMemoryMap.count(*identifier->name) ||
+                    unrolledIterators.count(*identifier->name))
+                {
+                    return;
+                }
+                names.insert(*identifier->name);
+            }
+        }
+
+        long long cell;
+        if (procedureCalls.back() == "main")
+        {
+            cell = getVariableMemoryAddress(*target->name);
+        }
+        else if (getProcedureIdentifierAddress(*target->name) == 2)
+        {
+            cell = getProcedureVariableAddress(*target->name);
+        }
+        else
+        {
+            return;
+        }
+        availableValues[key] = {cell, names};
+    }
+
+    void generateProcedureCallArguments(const std::string &procedureName, ProcedureCallArguments *arguments)
+    {
+        try
+        {
+            if (arguments->arguments.size() != argumentsPlaces[procedureName].size())
+            {
+                throw std::runtime_error("Argument count mismatch for procedure " + procedureName + ": expected " + std::to_string(argumentsPlaces[procedureName].size()) + " but got " + std::to_string(arguments->arguments.size()));
+            }
+            for (size_t i = 1; i <= arguments->arguments.size(); ++i)
+            {
+                const auto &arg = arguments->arguments[i - 1];
+                const auto &expectedArg = argumentsPlaces[procedureName][i];
+
+                if (auto identifier = dynamic_cast<IdentifierNode *>(arg))
+                {
+                    std::string procedureRemember = procedureCalls.back();
+                    procedureCalls.pop_back();
+                    auto sign = getProcedureIdentifierAddress(*identifier->name);
+                    procedureCalls.emplace_back(procedureRemember);
+                    if (sign != -1)
+                    {
+                        if (sign == 1)
+                        {
+                            if (expectedArg.second)
+                            {
+                                throw std::runtime_error("Argument type mismatch for procedure " + procedureName + ": expected " + (expectedArg.second ? "array" : "variable") + " but got " + (identifier->isArrayRange ? "array" : "variable"));
+                            }
+                            std::string procedureRemember = procedureCalls.back();
+                            procedureCalls.pop_back();
                             long long address = getProcedureArgumentAddress(*identifier->name);
-                            instructions.emplace_back("LOAD", address, true);
+                            code.emit("LOAD", address, true);
                             procedureCalls.emplace_back(procedureRemember);
                             long long argumentAddress = getProcedureArgumentAddress(expectedArg.first);
-                            instructions.emplace_back("STORE", argumentAddress, true);
+                            code.emit("STORE", argumentAddress, true);
                             memoryPointer++;
                         }
                         else if (sign == 2)
@@ -778,11 +1597,11 @@ public:
                             std::string procedureRemember = procedureCalls.back();
                             procedureCalls.pop_back();
                             long long address = getProcedureVariableAddress(*identifier->name);
-                            instructions.emplace_back("SET", address, true);
+                            code.emit("SET", address, true);
                             initializedVariables[procedureCalls.back()][*identifier->name] = true;
                             procedureCalls.emplace_back(procedureRemember);
                             long long argumentAddress = getProcedureArgumentAddress(expectedArg.first);
-                            instructions.emplace_back("STORE", argumentAddress, true);
+                            code.emit("STORE", argumentAddress, true);
                             memoryPointer++;
                         }
                         else if (sign == 3)
@@ -794,11 +1613,11 @@ public:
                             std::string procedureRemember = procedureCalls.back();
                             procedureCalls.pop_back();
                             long long address = getProcedureArrayElementAddress(*identifier->name);
-                            instructions.emplace_back("SET", address, true);
+                            code.emit("SET", address, true);
                             initializedVariables[procedureCalls.back()][*identifier->name] = true;
                             procedureCalls.emplace_back(procedureRemember);
                             long long argumentAddress = getProcedureArgumentsArrayElementAddress(expectedArg.first);
-                            instructions.emplace_back("STORE", argumentAddress, true);
+                            code.emit("STORE", argumentAddress, true);
                             memoryPointer++;
                         }
                         else if (sign == 4)
@@ -810,10 +1629,10 @@ public:
                             std::string procedureRemember = procedureCalls.back();
                             procedureCalls.pop_back();
                             long long address = getProcedureArgumentsArrayElementAddress(*identifier->name);
-                            instructions.emplace_back("LOAD", address, true);
+                            code.emit("LOAD", address, true);
                             procedureCalls.emplace_back(procedureRemember);
                             long long argumentAddress = getProcedureArgumentsArrayElementAddress(expectedArg.first);
-                            instructions.emplace_back("STORE", argumentAddress, true);
+                            code.emit("STORE", argumentAddress, true);
                             memoryPointer++;
                         }
                     }
@@ -824,9 +1643,9 @@ public:
                             throw std::runtime_error("Argument type mismatch for procedure " + procedureName + ": expected " + (expectedArg.second ? "array" : "variable") + " but got iterator");
                         }
                         long long address = getIteratorAddress(*identifier->name);
-                        instructions.emplace_back("SET", address, true);
+                        code.emit("SET", address, true);
                         long long argumentAddress = getProcedureArgumentAddress(expectedArg.first);
-                        instructions.emplace_back("STORE", argumentAddress, true);
+                        code.emit("STORE", argumentAddress, true);
                         memoryPointer++;
                     }
                     else if (auto test = getIdentifierAddress(*identifier->name); test != -1)
@@ -837,9 +1656,9 @@ public:
                         }
 
                         long long address = getArrayElementAddress(*identifier->name);
-                        instructions.emplace_back("SET", address, true);
+                        code.emit("SET", address, true);
                         long long argumentAddress = getProcedureArgumentArrayElementAddress(expectedArg.first);
-                        instructions.emplace_back("STORE", argumentAddress, true);
+                        code.emit("STORE", argumentAddress, true);
                         std::string procedureRemember = procedureCalls.back();
                         procedureCalls.pop_back();
                         initializedVariables[procedureCalls.back()][*identifier->name] = true;
@@ -854,9 +1673,9 @@ public:
                         }
 
                         long long address = getVariableMemoryAddress(*identifier->name);
-                        instructions.emplace_back("SET", address, true);
+                        code.emit("SET", address, true);
                         long long argumentAddress = getProcedureArgumentAddress(expectedArg.first);
-                        instructions.emplace_back("STORE", argumentAddress, true);
+                        code.emit("STORE", argumentAddress, true);
                         std::string procedureRemember = procedureCalls.back();
                         procedureCalls.pop_back();
                         initializedVariables[procedureCalls.back()][*identifier->name] = true;
@@ -872,366 +1691,687 @@ public:
         }
     }
 
-    void generateProcedureCall(ProcedureCallNode *procedureCallNode)
+    long long inlineArgumentKind(const std::string &name) const
     {
-        try
+        if (procedureCalls.back() != "main")
         {
-            if (!procedureCallNode)
-                return;
-
-            if (procedureCallNode->arguments)
+            long long kind = getProcedureIdentifierAddress(name);
+            if (kind != -1)
             {
-                if (procedureEntryPoints[*procedureCallNode->procedureName] == 0)
-                {
-                    throw std::runtime_error("Procedure not found: " + *procedureCallNode->procedureName);
-                }
-                if (procedureCalls.back() == *procedureCallNode->procedureName)
-                {
-                    throw std::runtime_error("Recursive call to procedure " + *procedureCallNode->procedureName);
-                }
-                procedureCalls.emplace_back(*procedureCallNode->procedureName);
-                generateProcedureCallArguments(*procedureCallNode->procedureName, procedureCallNode->arguments);
-                instructions.emplace_back("SET", instructions.size() + 3, true);
-                instructions.emplace_back("STORE", procedureVariables[*procedureCallNode->procedureName]["return"], true);
-                procedureCalls.pop_back();
+                return kind == 1 || kind == 2 ? 1 : 2;
             }
-
-            instructions.emplace_back("JUMP", procedureEntryPoints[*procedureCallNode->procedureName] - instructions.size(), true);
+            return iteratorMemoryMap.count(name) ? 3 : 0;
         }
-        catch (const CodeGeneratorError &e)
+        if (iteratorMemoryMap.count(name))
         {
-            throw;
+            return 3;
         }
-        catch (const std::runtime_error &e)
+        if (arrayMemoryMap.count(name))
         {
-            throw CodeGeneratorError(e.what(), procedureCallNode->getLineNumber());
+            return 2;
         }
+        return variableMemoryMap.count(name) ? 1 : 0;
     }
 
-    void generateRepeatUntilCommand(RepeatUntilNode *repeatUntilNode)
+    bool bindInlineArguments(const std::string &name, ProcedureNode *procedure, ProcedureCallArguments *arguments, std::map<std::string, std::string> &renames)
     {
-        try
+        auto &places = argumentsPlaces[name];
+        if (arguments->arguments.size() != places.size())
         {
-            long long start = instructions.size();
-            generateCommands(repeatUntilNode->commands);
-            generateCondition(repeatUntilNode->condition);
+            return false;
+        }
 
-            if (repeatUntilNode->condition->operation == "=")
-            {
-                instructions.emplace_back("JZERO", 2, true);
-                instructions.emplace_back("JUMP", start - instructions.size(), true);
-            }
-            else if (repeatUntilNode->condition->operation == "!=")
-            {
-                instructions.emplace_back("JZERO", start - instructions.size(), true);
-            }
-            else if (repeatUntilNode->condition->operation == "<")
-            {
-                instructions.emplace_back("JPOS", 2, true);
-                instructions.emplace_back("JUMP", start - instructions.size(), true);
-            }
-            else if (repeatUntilNode->condition->operation == ">")
+        LoopWrites writes;
+        LoopAnalysis::collectWrites(procedure->commands, writes);
+        for (size_t i = 1; i <= places.size(); ++i)
+        {
+            auto identifier = dynamic_cast<IdentifierNode *>(arguments->arguments[i - 1]);
+            if (!identifier || identifier->index)
             {
-                instructions.emplace_back("JNEG", 2, true);
-                instructions.emplace_back("JUMP", start - instructions.size(), true);
+                return false;
             }
-            else if (repeatUntilNode->condition->operation == ">=")
+            const auto &[parameter, isArray] = places[i];
+            long long kind = inlineArgumentKind(*identifier->name);
+            if (kind == 0 || isArray != (kind == 2) || (kind == 3 && writes.scalars.count(parameter)))
             {
-                instructions.emplace_back("JPOS", start - instructions.size(), true);
+                return false;
             }
-            else if (repeatUntilNode->condition->operation == "<=")
+            renames[parameter] = *identifier->name;
+        }
+
+        std::set<std::string> iterators;
+        LoopAnalysis::collectIterators(procedure->commands, iterators);
+        for (const auto &iterator : iterators)
+        {
+            if (renames.count(iterator) || procedureVariables[name].count(iterator) || procedureArrays[name].count(iterator))
             {
-                instructions.emplace_back("JNEG", start - instructions.size(), true);
+                return false;
             }
         }
-        catch (const CodeGeneratorError &e)
+        return true;
+    }
+
+    bool canInline(ProcedureCallNode *call, std::map<std::string, std::string> &renames)
+    {
+        const std::string &name = *call->procedureName;
+        auto found = procedureNodes.find(name);
+        if (!call->arguments || found == procedureNodes.end() || !procedureEntryPoints.count(name) || procedureCalls.back() == name)
         {
-            throw;
+            return false;
         }
-        catch (const std::runtime_error &e)
+
+        long long size = LoopAnalysis::estimateSize(found->second->commands, procedureSizes);
+        if (!withinGrowthBudget(LoopAnalysis::estimateSize(found->second->commands)))
         {
-            throw CodeGeneratorError(e.what(), repeatUntilNode->getLineNumber());
+            return false;
         }
+        bool hot = (profile ? profile->entries(call) > 1 : callsInLoops.count(call) > 0) && size <= inlineLoopMaxSize;
+        if (procedureCallCounts[name] > 1 && size > inlineMaxSize && !hot)
+        {
+            return false;
+        }
+        return bindInlineArguments(name, found->second, call->arguments, renames);
     }
 
-    void generateWhileNode(WhileNode *whileNode)
+    bool withinGrowthBudget(long long growth) const
     {
-        try
+        return codeGrowth + growth <= std::max(codeGrowthMinimum, programSize * codeGrowthFactor);
+    }
+
+    bool inlineProcedureCall(ProcedureCallNode *call)
+    {
+        std::map<std::string, std::string> renames;
+        if (!canInline(call, renames))
         {
-            long long start = instructions.size();
-            generateCondition(whileNode->condition);
+            return false;
+        }
 
-            if (whileNode->condition->operation == "=")
-            {
-                instructions.emplace_back("JZERO", 2, true);
+        codeGrowth += LoopAnalysis::estimateSize(procedureNodes[*call->procedureName]->commands);
+        generateBoundProcedureBody(*call->procedureName, procedureNodes[*call->procedureName], renames);
+        inlinedCalls++;
+        return true;
+    }
 
-                instructions.emplace_back("JUMP", 0, true);
-                long long skipDoBlock = instructions.size() - 1;
+    bool reachesProcedure(const std::string &from, const std::string &target)
+    {
+        auto found = procedureNodes.find(from);
+        if (found == procedureNodes.end())
+        {
+            return false;
+        }
+        bool reached = false;
+        LoopAnalysis::forEachCall(found->second->commands, [&](ProcedureCallNode *call, bool)
+                                  { reached = reached || *call->procedureName == target || reachesProcedure(*call->procedureName, target); });
+        return reached;
+    }
 
-                generateCommands(whileNode->commands);
-                instructions.emplace_back("JUMP", start - instructions.size(), true);
+    void prepareLoopCalls(CommandsNode *commands)
+    {
+        std::vector<ProcedureCallNode *> calls;
+        LoopAnalysis::forEachCall(commands, [&](ProcedureCallNode *call, bool)
+                                  { calls.push_back(call); });
+        std::vector<ProcedureCallNode *> candidates;
+        LoopAnalysis::collectCallsOutsideFor(commands, candidates);
 
-                instructions[skipDoBlock].argument = instructions.size() - skipDoBlock;
-            }
-            else if (whileNode->condition->operation == "!=")
+        for (auto call : candidates)
+        {
+            const std::string &name = *call->procedureName;
+            std::map<std::string, std::string> renames;
+            if (preparedCalls.count(call) || canInline(call, renames) || !call->arguments ||
+                !procedureNodes.count(name) || !procedureEntryPoints.count(name) || procedureCalls.back() == name ||
+                !bindInlineArguments(name, procedureNodes[name], call->arguments, renames))
             {
-                instructions.emplace_back("JZERO", 2, true);
-                long long skipDoBlock = instructions.size() - 1;
-
-                generateCommands(whileNode->commands);
-
-                instructions.emplace_back("JUMP", start - instructions.size(), true);
-
-                instructions[skipDoBlock].argument = instructions.size() - skipDoBlock;
+                continue;
             }
-            else if (whileNode->condition->operation == "<")
-            {
-                instructions.emplace_back("JPOS", 2, true);
-                instructions.emplace_back("JUMP", 0, true);
-                long long skipDoBlock = instructions.size() - 1;
-
-                generateCommands(whileNode->commands);
-                instructions.emplace_back("JUMP", start - instructions.size(), true);
 
-                instructions[skipDoBlock].argument = instructions.size() - skipDoBlock;
-            }
-            else if (whileNode->condition->operation == ">")
+            bool conflict = false;
+            for (auto other : calls)
             {
-                instructions.emplace_back("JNEG", 2, true);
-                instructions.emplace_back("JUMP", 0, true);
-                long long skipDoBlock = instructions.size() - 1;
-
-                generateCommands(whileNode->commands);
-                instructions.emplace_back("JUMP", start - instructions.size(), true);
-
-                instructions[skipDoBlock].argument = instructions.size() - skipDoBlock;
+                conflict = conflict || (other != call && (*other->procedureName == name || reachesProcedure(*other->procedureName, name) ||
+                                                          framesCollide(*other->procedureName, name)));
             }
-            else if (whileNode->condition->operation == ">=")
+            if (conflict)
             {
-                instructions.emplace_back("JPOS", start - instructions.size(), true);
-                long long skipDoBlock = instructions.size() - 1;
-
-                generateCommands(whileNode->commands);
-
-                instructions.emplace_back("JUMP", start - instructions.size(), true);
+                continue;
+            }
 
-                instructions[skipDoBlock].argument = instructions.size() - skipDoBlock;
+            long long entryLabel = cloneProcedureCall(call);
+            if (entryLabel == -1)
+            {
+                procedureCalls.emplace_back(name);
+                generateProcedureCallArguments(name, call->arguments);
+                procedureCalls.pop_back();
+                entryLabel = procedureEntryPoints[name];
             }
-            else if (whileNode->condition->operation == "<=")
+            else
             {
-                instructions.emplace_back("JNEG", start - instructions.size(), true);
-                long long skipDoBlock = instructions.size() - 1;
-
-                generateCommands(whileNode->commands);
-
-                instructions.emplace_back("JUMP", start - instructions.size(), true);
-
-                instructions[skipDoBlock].argument = instructions.size() - skipDoBlock;
+                markCloneArguments(call);
             }
+
+            long long returnLabel = code.newLabel();
+            code.emitLabelAddress(returnLabel);
+            code.emit("STORE", procedureVariables[name]["return"], true);
+            preparedCalls[call] = {entryLabel, returnLabel};
+            preparedCallCount++;
         }
-        catch (const CodeGeneratorError &e)
-        {
-            throw;
-        }
-        catch (const std::runtime_error &e)
+    }
+
+    void markCloneArguments(ProcedureCallNode *call)
+    {
+        for (auto argument : call->arguments->arguments)
         {
-            throw CodeGeneratorError(e.what(), whileNode->getLineNumber());
+            initializedVariables["main"][*dynamic_cast<IdentifierNode *>(argument)->name] = true;
         }
     }
 
-    void generateForToNode(ForToNode *forToNode)
+    void generateBoundProcedureBody(const std::string &name, ProcedureNode *procedure, std::map<std::string, std::string> renames)
     {
-        try
+        const std::string &caller = procedureCalls.back();
+        for (const auto &[parameter, argument] : renames)
         {
-            auto procedureName = procedureCalls.back();
-            procedureIterators[procedureName][*forToNode->pidentifier->name] = true;
+            if (!iteratorMemoryMap.count(argument))
+            {
+                initializedVariables[caller][argument] = true;
+            }
+        }
 
-            allocateIterator(*forToNode->pidentifier->name);
-            long long iterator = getIteratorAddress(*forToNode->pidentifier->name);
+        std::vector<IdentifierNode *> identifiers;
+        LoopAnalysis::forEachIdentifier(procedure->commands, [&](IdentifierNode *identifier)
+                                        { identifiers.push_back(identifier); });
+        for (auto identifier : identifiers)
+        {
+            if (!renames.count(*identifier->name))
+            {
+                renames[*identifier->name] = *identifier->name + "@" + name;
+            }
+        }
 
-            if (procedureCalls.back() != "main")
+        std::vector<std::string> locals;
+        for (const auto &[local, address] : procedureVariables[name])
+        {
+            if (local == "return" || !renames.count(local) || isCopiedArgument(name, local))
+            {
+                continue;
+            }
+            locals.push_back(renames[local]);
+            if (caller == "main")
+            {
+                variableMemoryMap[renames[local]] = address;
+            }
+            else
+            {
+                procedureVariables[caller][renames[local]] = address;
+            }
+        }
+        for (const auto &[local, storage] : procedureArrays[name])
+        {
+            if (!renames.count(local))
+            {
+                continue;
+            }
+            long long offset = procedureArrayOffsets[name][local];
+            code.emit("SET", arrayOffsetCellValue(offset), true);
+            code.emit("STORE", storage.first, true);
+            locals.push_back(renames[local]);
+            if (caller == "main")
+            {
+                arrayMemoryMap[renames[local]] = storage;
+                arrayOffsets[renames[local]] = offset;
+            }
+            else
+            {
+                procedureArrays[caller][renames[local]] = storage;
+                procedureArrayOffsets[caller][renames[local]] = offset;
+            }
+        }
+
+        std::vector<std::string *> originalNames;
+        for (auto identifier : identifiers)
+        {
+            originalNames.push_back(identifier->name);
+            identifier->name = &renames[*identifier->name];
+        }
+        auto restore = [&]()
+        {
+            for (size_t i = 0; i < identifiers.size(); ++i)
+            {
+                identifiers[i]->name = originalNames[i];
+            }
+            for (const auto &local : locals)
+            {
+                variableMemoryMap.erase(local);
+                arrayMemoryMap.erase(local);
+                arrayOffsets.erase(local);
+                procedureVariables[caller].erase(local);
+                procedureArrays[caller].erase(local);
+                procedureArrayOffsets[caller].erase(local);
+                initializedVariables[caller].erase(local);
+            }
+        };
+
+        try
+        {
+            generateCommands(procedure->commands);
+        }
+        catch (...)
+        {
+            restore();
+            throw;
+        }
+        restore();
+    }
+
+    long long cloneProcedureCall(ProcedureCallNode *call)
+    {
+        const std::string &name = *call->procedureName;
+        auto found = procedureNodes.find(name);
+        if (!call->arguments || found == procedureNodes.end() || !procedureEntryPoints.count(name) || procedureCalls.back() != "main")
+        {
+            return -1;
+        }
+
+        std::string key = name;
+        for (auto argument : call->arguments->arguments)
+        {
+            auto identifier = dynamic_cast<IdentifierNode *>(argument);
+            if (!identifier || iteratorMemoryMap.count(*identifier->name) || identifier->name->find('@') != std::string::npos)
+            {
+                return -1;
+            }
+            key += " " + *identifier->name;
+        }
+
+        auto clone = procedureClones.find(key);
+        if (clone != procedureClones.end())
+        {
+            return clone->second;
+        }
+
+        std::map<std::string, std::string> renames;
+        long long size = LoopAnalysis::estimateSize(found->second->commands);
+        if (procedureCloneCounts[name] >= procedureCloneLimit || !withinGrowthBudget(size) ||
+            !bindInlineArguments(name, found->second, call->arguments, renames))
+        {
+            return -1;
+        }
+        codeGrowth += size;
+
+        long long entryLabel = code.newLabel();
+        procedureCloneCounts[name]++;
+        procedureClones[key] = entryLabel;
+        pendingClones.push_back({entryLabel, {name, renames}});
+        return entryLabel;
+    }
+
+    void generateProcedureClones()
+    {
+        procedureCalls.emplace_back("main");
+        for (size_t i = 0; i < pendingClones.size(); ++i)
+        {
+            auto [entryLabel, binding] = pendingClones[i];
+            memoryPointer = std::max(memoryPointer, maxMemoryPointer) + 1;
+            code.enterOrigin(procedureNodes[binding.first]);
+            code.placeLabel(entryLabel);
+            availableValues.clear();
+            knownRanges.clear();
+            generateBoundProcedureBody(binding.first, procedureNodes[binding.first], binding.second);
+            code.emit("RTRN", procedureVariables[binding.first]["return"], true);
+            code.leaveOrigin();
+            maxMemoryPointer = std::max(maxMemoryPointer, memoryPointer);
+        }
+        procedureCalls.pop_back();
+    }
+
+    void generateProcedureCall(ProcedureCallNode *procedureCallNode)
+    {
+        try
+        {
+            if (!procedureCallNode || (!preparedCalls.count(procedureCallNode) && inlineProcedureCall(procedureCallNode)))
+                return;
+
+            auto prepared = preparedCalls.find(procedureCallNode);
+            if (prepared != preparedCalls.end())
             {
-                if (auto fromValue = dynamic_cast<IdentifierNode *>(forToNode->fromValue))
+                code.emitJump("JUMP", prepared->second.first);
+                code.placeLabel(prepared->second.second);
+                preparedCalls.erase(prepared);
+                return;
+            }
+
+            long long returnLabel = code.newLabel();
+            long long cloneLabel = cloneProcedureCall(procedureCallNode);
+            if (cloneLabel != -1)
+            {
+                markCloneArguments(procedureCallNode);
+                code.emitLabelAddress(returnLabel);
+                code.emit("STORE", procedureVariables[*procedureCallNode->procedureName]["return"], true);
+                code.emitJump("JUMP", cloneLabel);
+                code.placeLabel(returnLabel);
+                return;
+            }
+            if (procedureCallNode->arguments)
+            {
+                if (!procedureEntryPoints.count(*procedureCallNode->procedureName))
                 {
-                    auto address = getProcedureIdentifierAddress(*fromValue->name);
-                    auto it = iteratorMemoryMap.find(*fromValue->name);
-                    if (fromValue->index || (address == 3 || address == 4))
-                    {
-                        if (!fromValue->index)
-                        {
-                            throw std::runtime_error("Misuse of array variable: " + *fromValue->name);
-                        }
-                        else if (address == 3)
-                        {
-                            generateProcedureArrayAccess(fromValue);
-                            loadArrayValue(memoryPointer);
-                        }
-                        else if (address == 4)
-                        {
-                            generateProcedureArgumentsArrayAccess(fromValue);
-                            loadArrayValue(memoryPointer);
-                        }
-                        else
-                        {
-                            throw std::runtime_error("Undeclared array: " + *fromValue->name);
-                        }
-                    }
-                    else if (address == 1)
-                    {
-                        address = getProcedureArgumentAddress(*fromValue->name);
-                        instructions.emplace_back("LOADI", address, true);
-                    }
-                    else if (address == 2)
-                    {
-                        isInitialiazed(fromValue);
-                        address = getProcedureVariableAddress(*fromValue->name);
-                        instructions.emplace_back("LOAD", address, true);
-                    }
-                    else if (it != iteratorMemoryMap.end())
-                    {
-                        long long address = getIteratorAddress(*fromValue->name);
-                        instructions.emplace_back("LOAD", address, true);
-                    }
-                    else
-                    {
-                        throw std::runtime_error("Undeclared variable: " + *fromValue->name);
-                    }
+                    throw std::runtime_error("Procedure not found: " + *procedureCallNode->procedureName);
                 }
-                else if (auto valueNode = dynamic_cast<ValueNode *>(forToNode->fromValue))
+                if (procedureCalls.back() == *procedureCallNode->procedureName)
                 {
-                    instructions.emplace_back("SET", valueNode->value, true);
+                    throw std::runtime_error("Recursive call to procedure " + *procedureCallNode->procedureName);
                 }
+                procedureCalls.emplace_back(*procedureCallNode->procedureName);
+                generateProcedureCallArguments(*procedureCallNode->procedureName, procedureCallNode->arguments);
+                code.emitLabelAddress(returnLabel);
+                code.emit("STORE", procedureVariables[*procedureCallNode->procedureName]["return"], true);
+                procedureCalls.pop_back();
+            }
+
+            code.emitJump("JUMP", procedureEntryPoints[*procedureCallNode->procedureName]);
+            code.placeLabel(returnLabel);
+        }
+        catch (const CodeGeneratorError &e)
+        {
+            throw;
+        }
+        catch (const std::runtime_error &e)
+        {
+            throw CodeGeneratorError(e.what(), procedureCallNode->getLineNumber());
+        }
+    }
+
+    void generateRepeatUntilCommand(RepeatUntilNode *repeatUntilNode)
+    {
+        try
+        {
+            auto previousHoisted = hoistedValues;
+            long long hoisted = hoistLoopInvariants({repeatUntilNode->commands, repeatUntilNode->condition}, "", nullptr);
+            auto previousPrepared = preparedCalls;
+            prepareLoopCalls(repeatUntilNode->commands);
+
+            long long start = code.newLabel();
+            code.placeLabel(start);
+            generateLoopBody(repeatUntilNode->commands);
+            generateBranchTo(repeatUntilNode->condition, false, start);
+
+            releaseHoisted(hoisted, previousHoisted);
+            preparedCalls = previousPrepared;
+        }
+        catch (const CodeGeneratorError &e)
+        {
+            throw;
+        }
+        catch (const std::runtime_error &e)
+        {
+            throw CodeGeneratorError(e.what(), repeatUntilNode->getLineNumber());
+        }
+    }
+
+    void generateBranchIfFalse(ConditionNode *condition, long long falseLabel)
+    {
+        long long body = code.newLabel();
+        std::string operation = generateCondition(condition);
+
+        if (operation == "=")
+        {
+            code.emitJump("JZERO", body);
+            code.emitJump("JUMP", falseLabel);
+        }
+        else if (operation == "!=")
+        {
+            code.emitJump("JZERO", falseLabel);
+        }
+        else if (operation == "<")
+        {
+            code.emitJump("JPOS", body);
+            code.emitJump("JUMP", falseLabel);
+        }
+        else if (operation == ">")
+        {
+            code.emitJump("JNEG", body);
+            code.emitJump("JUMP", falseLabel);
+        }
+        else if (operation == ">=")
+        {
+            code.emitJump("JPOS", falseLabel);
+        }
+        else if (operation == "<=")
+        {
+            code.emitJump("JNEG", falseLabel);
+        }
+        code.placeLabel(body);
+    }
+
+    void generateBranchTo(ConditionNode *condition, bool holds, long long label)
+    {
+        static const std::map<std::string, std::vector<std::string>> jumpsWhenTrue = {
+            {"=", {"JZERO"}}, {"!=", {"JPOS", "JNEG"}}, {"<", {"JPOS"}}, {">", {"JNEG"}}, {">=", {"JNEG", "JZERO"}}, {"<=", {"JPOS", "JZERO"}}};
+        static const std::map<std::string, std::string> negated = {
+            {"=", "!="}, {"!=", "="}, {"<", ">="}, {">=", "<"}, {">", "<="}, {"<=", ">"}};
+
+        std::string operation = generateCondition(condition);
+        for (const auto &jump : jumpsWhenTrue.at(holds ? operation : negated.at(operation)))
+        {
+            code.emitJump(jump, label);
+        }
+    }
+
+    std::string expressionKey(ExpressionNode *node) const
+    {
+        if (auto value = dynamic_cast<ValueNode *>(node))
+        {
+            return std::to_string(value->value);
+        }
+        if (auto identifier = dynamic_cast<IdentifierNode *>(node))
+        {
+            return *identifier->name + (identifier->index ? "[" + expressionKey(identifier->index) + "]" : "");
+        }
+        if (auto binary = dynamic_cast<BinaryExpressionNode *>(node))
+        {
+            return "(" + expressionKey(binary->left) + binary->operation + expressionKey(binary->right) + ")";
+        }
+        return "";
+    }
+
+    bool isLoopInvariant(ExpressionNode *node, const LoopWrites &writes) const
+    {
+        if (auto identifier = dynamic_cast<IdentifierNode *>(node))
+        {
+            if (identifier->index)
+            {
+                return !writes.arrays.count(*identifier->name) && isLoopInvariant(identifier->index, writes);
             }
-            else if (auto fromValue = dynamic_cast<IdentifierNode *>(forToNode->fromValue))
+            return !writes.scalars.count(*identifier->name);
+        }
+        if (auto binary = dynamic_cast<BinaryExpressionNode *>(node))
+        {
+            return isLoopInvariant(binary->left, writes) && isLoopInvariant(binary->right, writes);
+        }
+        return dynamic_cast<ValueNode *>(node) != nullptr;
+    }
+
+    static bool readsNoArray(ExpressionNode *node)
+    {
+        auto identifier = dynamic_cast<IdentifierNode *>(node);
+        return !identifier || !identifier->index;
+    }
+
+    LoopWrites collectLoopWrites(const std::vector<AstNode *> &regions, const std::string &iterator)
+    {
+        LoopWrites writes;
+        for (auto region : regions)
+        {
+            LoopAnalysis::collectWrites(region, writes);
+        }
+        if (!iterator.empty())
+        {
+            writes.scalars.insert(iterator);
+        }
+
+        const std::string &procedure = procedureCalls.back();
+        if (procedure == "main")
+        {
+            return writes;
+        }
+        for (const auto &name : LoopWrites(writes).scalars)
+        {
+            if (procedureArguments[procedure].count(name))
             {
-                auto it = iteratorMemoryMap.find(*fromValue->name);
-                if (fromValue->index)
+                for (const auto &[argument, slot] : procedureArguments[procedure])
                 {
-                    generateArrayAccess(fromValue);
-                    loadArrayValue(memoryPointer);
+                    writes.scalars.insert(argument);
                 }
-                else if (it != iteratorMemoryMap.end())
-                {
-                    long long address = getIteratorAddress(*fromValue->name);
-                    instructions.emplace_back("LOAD", address, true);
-                }
-                else
+                break;
+            }
+        }
+        for (const auto &name : LoopWrites(writes).arrays)
+        {
+            if (procedureArgumentsArrays[procedure].count(name))
+            {
+                for (const auto &[argument, slot] : procedureArgumentsArrays[procedure])
                 {
-                    isInitialiazed(fromValue);
-                    long long address = getVariableMemoryAddress(*fromValue->name);
-                    instructions.emplace_back("LOAD", address, true);
+                    writes.arrays.insert(argument);
                 }
+                break;
             }
-            else if (auto valueNode = dynamic_cast<ValueNode *>(forToNode->fromValue))
+        }
+        return writes;
+    }
+
+    bool isResolvable(AstNode *node)
+    {
+        if (dynamic_cast<ValueNode *>(node))
+        {
+            return true;
+        }
+        auto variable = dynamic_cast<IdentifierNode *>(node);
+        if (!variable)
+        {
+            return false;
+        }
+
+        const std::string &name = *variable->name;
+        bool initialized = initializedVariables[procedureCalls.back()].count(name) > 0;
+        if (variable->index)
+        {
+            auto index = dynamic_cast<IdentifierNode *>(variable->index);
+            if (!isResolvable(variable->index) || (index && !initializedVariables[procedureCalls.back()].count(*index->name)))
             {
-                instructions.emplace_back("SET", valueNode->value, true);
+                return false;
             }
+            if (procedureCalls.back() == "main")
+            {
+                return arrayMemoryMap.count(name) > 0;
+            }
+            long long address = getProcedureIdentifierAddress(name);
+            return address == 3 || address == 4;
+        }
 
-            instructions.emplace_back("STORE", iterator, true);
+        if (procedureCalls.back() == "main")
+        {
+            return iteratorMemoryMap.count(name) || (variableMemoryMap.count(name) && initialized);
+        }
+        long long address = getProcedureIdentifierAddress(name);
+        return address == 1 || (address == 2 && initialized) || (address == -1 && iteratorMemoryMap.count(name));
+    }
 
-            if (procedureCalls.back() != "main")
-            {
-                if (auto rightVar = dynamic_cast<IdentifierNode *>(forToNode->toValue))
+    long long hoistLoopInvariants(const std::vector<AstNode *> &regions, const std::string &iterator, const std::function<void()> &emitGuard)
+    {
+        LoopWrites writes = collectLoopWrites(regions, iterator);
+        std::vector<ExpressionNode *> candidates;
+        std::set<std::string> seen;
+        for (auto region : regions)
+        {
+            LoopAnalysis::forEachExpression(region, [&](ExpressionNode *expression)
+                                            {
+                std::string key;
+                if (auto binary = dynamic_cast<BinaryExpressionNode *>(expression))
                 {
-                    auto address = getProcedureIdentifierAddress(*rightVar->name);
-                    auto it = iteratorMemoryMap.find(*rightVar->name);
-                    if (rightVar->index || (address == 3 || address == 4))
+                    if ((binary->operation == "*" || binary->operation == "/" || binary->operation == "%") &&
+                        isLoopInvariant(binary, writes) && readsNoArray(binary->left) && readsNoArray(binary->right) &&
+                        isResolvable(binary->left) && isResolvable(binary->right))
                     {
-                        if (!rightVar->index)
-                        {
-                            throw std::runtime_error("Misuse of array variable: " + *rightVar->name);
-                        }
-                        else if (address == 3)
-                        {
-                            generateProcedureArrayAccess(rightVar);
-                            loadArrayValue(memoryPointer);
-                        }
-                        else if (address == 4)
-                        {
-                            generateProcedureArgumentsArrayAccess(rightVar);
-                            loadArrayValue(memoryPointer);
-                        }
-                        else
-                        {
-                            throw std::runtime_error("Undeclared array: " + *rightVar->name);
-                        }
+                        key = expressionKey(binary);
                     }
-                    else if (address == 1)
-                    {
-                        address = getProcedureArgumentAddress(*rightVar->name);
-                        instructions.emplace_back("LOADI", address, true);
-                    }
-                    else if (address == 2)
-                    {
-                        isInitialiazed(rightVar);
-                        address = getProcedureVariableAddress(*rightVar->name);
-                        instructions.emplace_back("LOAD", address, true);
-                    }
-                    else if (it != iteratorMemoryMap.end())
-                    {
-                        long long address = getIteratorAddress(*rightVar->name);
-                        instructions.emplace_back("LOAD", address, true);
-                    }
-                    else
+                }
+                else if (auto identifier = dynamic_cast<IdentifierNode *>(expression))
+                {
+                    auto index = dynamic_cast<IdentifierNode *>(identifier->index);
+                    if (index && isLoopInvariant(index, writes) && isResolvable(identifier))
                     {
-                        throw std::runtime_error("Undeclared variable: " + *rightVar->name);
+                        key = "&" + expressionKey(identifier);
                     }
                 }
-                else if (auto valueNode = dynamic_cast<ValueNode *>(forToNode->toValue))
+                if (!key.empty() && !hoistedValues.count(key) && seen.insert(key).second)
                 {
-                    instructions.emplace_back("SET", valueNode->value, true);
-                }
+                    candidates.push_back(expression);
+                } });
+        }
+        if (candidates.empty())
+        {
+            return 0;
+        }
+
+        if (emitGuard)
+        {
+            emitGuard();
+        }
+
+        long long hoisted = 0;
+        for (auto candidate : candidates)
+        {
+            if (auto binary = dynamic_cast<BinaryExpressionNode *>(candidate))
+            {
+                generateExpression(binary);
+                code.emit("STORE", memoryPointer, true);
+                hoistedValues[expressionKey(binary)] = memoryPointer++;
+                hoisted++;
             }
-            else if (auto toValue = dynamic_cast<IdentifierNode *>(forToNode->toValue))
+            else
             {
-                auto it = iteratorMemoryMap.find(*toValue->name);
-                if (toValue->index)
-                {
-                    generateArrayAccess(toValue);
-                    loadArrayValue(memoryPointer);
-                }
-                else if (it != iteratorMemoryMap.end())
+                Operand address = resolveOperand(candidate);
+                if (address.temporary)
                 {
-                    long long address = getIteratorAddress(*toValue->name);
-                    instructions.emplace_back("LOAD", address, true);
-                }
-                else
-                {
-                    isInitialiazed(toValue);
-                    long long address = getVariableMemoryAddress(*toValue->name);
-                    instructions.emplace_back("LOAD", address, true);
+                    hoistedValues["&" + expressionKey(candidate)] = address.value;
+                    hoisted++;
                 }
             }
-            else if (auto valueNode = dynamic_cast<ValueNode *>(forToNode->toValue))
-            {
-                instructions.emplace_back("SET", valueNode->value, true);
-            }
-
-            instructions.emplace_back("STORE", memoryPointer, true);
-            long long toValue = memoryPointer++;
-
-            instructions.emplace_back("LOAD", iterator, true);
-            long long loopStart = instructions.size() - 1;
-            instructions.emplace_back("SUB", toValue, true);
-            instructions.emplace_back("JPOS", 0, true);
-            long long skipLoopJump = instructions.size() - 1;
-
-            generateCommands(forToNode->commands);
+        }
+        return hoisted;
+    }
 
-            instructions.emplace_back("SET", 1, true);
-            instructions.emplace_back("ADD", iterator, true);
-            instructions.emplace_back("STORE", iterator, true);
+    void releaseHoisted(long long hoisted, const std::unordered_map<std::string, long long> &previousHoisted)
+    {
+        maxMemoryPointer = std::max(maxMemoryPointer, memoryPointer);
+        memoryPointer -= hoisted;
+        hoistedValues = previousHoisted;
+    }
 
-            instructions.emplace_back("JUMP", loopStart - instructions.size(), true);
+    void generateWhileNode(WhileNode *whileNode)
+    {
+        try
+        {
+            long long body = code.newLabel();
+            long long skipDoBlock = code.newLabel();
 
-            long long loopEnd = instructions.size();
-            instructions[skipLoopJump].argument = loopEnd - skipLoopJump;
+            bool guarded = false;
+            auto previousHoisted = hoistedValues;
+            long long hoisted = hoistLoopInvariants({whileNode->commands, whileNode->condition}, "", [&]()
+                                                    { generateBranchIfFalse(whileNode->condition, skipDoBlock);
+                                                      guarded = true; });
+            if (!guarded)
+            {
+                generateBranchIfFalse(whileNode->condition, skipDoBlock);
+            }
+            auto previousPrepared = preparedCalls;
+            prepareLoopCalls(whileNode->commands);
 
-            maxMemoryPointer = std::max(maxMemoryPointer, memoryPointer);
+            code.placeLabel(body);
+            generateLoopBody(whileNode->commands, whileNode->condition);
+            generateBranchTo(whileNode->condition, true, body);
+            code.placeLabel(skipDoBlock);
 
-            memoryPointer -= 1;
-            deallocateIterator(*forToNode->pidentifier->name);
-            procedureIterators[procedureName][*forToNode->pidentifier->name] = false;
+            releaseHoisted(hoisted, previousHoisted);
+            preparedCalls = previousPrepared;
         }
         catch (const CodeGeneratorError &e)
         {
@@ -1239,198 +2379,417 @@ public:
         }
         catch (const std::runtime_error &e)
         {
-            throw CodeGeneratorError(e.what(), forToNode->getLineNumber());
+            throw CodeGeneratorError(e.what(), whileNode->getLineNumber());
         }
     }
 
-    void generateForDownToNode(ForDownToNode *forToNode)
+    std::vector<long long> generateInductionPointers(const std::string &name, long long iterator, const IteratorUsage &usage)
     {
-        try
+        std::vector<long long> pointers;
+        for (const auto &[array, uses] : usage.indexedArrays)
         {
-            allocateIterator(*forToNode->pidentifier->name);
-            long long iterator = getIteratorAddress(*forToNode->pidentifier->name);
+            if (usage.otherUses > 0 && uses < 2)
+            {
+                continue;
+            }
 
-            if (procedureCalls.back() != "main")
+            long long kind = procedureCalls.back() == "main" ? (arrayOffsets.count(array) ? 0 : -1) : getProcedureIdentifierAddress(array);
+            if (kind != 0 && kind != 3 && kind != 4)
+            {
+                continue;
+            }
+
+            code.emit("LOAD", iterator, true);
+            if (kind == 0)
+            {
+                addArrayOffset(getArrayElementAddress(array), false);
+            }
+            else if (kind == 3)
+            {
+                addArrayOffset(getProcedureArrayElementAddress(array), false);
+            }
+            else
             {
-                if (auto fromValue = dynamic_cast<IdentifierNode *>(forToNode->fromValue))
+                addArrayOffset(getProcedureArgumentArrayElementAddress(array), true);
+            }
+            code.emit("STORE", memoryPointer, true);
+            inductionPointers[{array, name}] = memoryPointer;
+            pointers.push_back(memoryPointer++);
+        }
+        return pointers;
+    }
+
+    bool writesThroughCall(CommandsNode *commands, const std::string &name)
+    {
+        bool written = false;
+        LoopAnalysis::forEachCall(commands, [&](ProcedureCallNode *call, bool)
+                                  {
+            if (!call->arguments)
+            {
+                return;
+            }
+            for (size_t i = 0; i < call->arguments->arguments.size(); ++i)
+            {
+                auto identifier = dynamic_cast<IdentifierNode *>(call->arguments->arguments[i]);
+                if (!identifier || *identifier->name != name)
                 {
-                    auto address = getProcedureIdentifierAddress(*fromValue->name);
-                    auto it = iteratorMemoryMap.find(*fromValue->name);
-                    if (fromValue->index || (address == 3 || address == 4))
-                    {
-                        if (!fromValue->index)
-                        {
-                            throw std::runtime_error("Misuse of array variable: " + *fromValue->name);
-                        }
-                        else if (address == 3)
-                        {
-                            generateProcedureArrayAccess(fromValue);
-                            loadArrayValue(memoryPointer);
-                        }
-                        else if (address == 4)
-                        {
-                            generateProcedureArgumentsArrayAccess(fromValue);
-                            loadArrayValue(memoryPointer);
-                        }
-                        else
-                        {
-                            throw std::runtime_error("Undeclared array: " + *fromValue->name);
-                        }
-                    }
-                    else if (address == 1)
-                    {
-                        address = getProcedureArgumentAddress(*fromValue->name);
-                        instructions.emplace_back("LOADI", address, true);
-                    }
-                    else if (address == 2)
-                    {
-                        isInitialiazed(fromValue);
-                        address = getProcedureVariableAddress(*fromValue->name);
-                        instructions.emplace_back("LOAD", address, true);
-                    }
-                    else if (it != iteratorMemoryMap.end())
-                    {
-                        long long address = getIteratorAddress(*fromValue->name);
-                        instructions.emplace_back("LOAD", address, true);
-                    }
-                    else
-                    {
-                        throw std::runtime_error("Undeclared variable: " + *fromValue->name);
-                    }
+                    continue;
                 }
-                else if (auto valueNode = dynamic_cast<ValueNode *>(forToNode->fromValue))
+                auto procedure = procedureNodes.find(*call->procedureName);
+                auto place = argumentsPlaces[*call->procedureName].find(i + 1);
+                if (procedure == procedureNodes.end() || place == argumentsPlaces[*call->procedureName].end())
                 {
-                    instructions.emplace_back("SET", valueNode->value, true);
+                    written = true;
+                    continue;
                 }
+                LoopWrites writes;
+                LoopAnalysis::collectWrites(procedure->second->commands, writes);
+                written |= writes.scalars.count(place->second.first) > 0;
+            } });
+        return written;
+    }
+
+    bool generateUnrolledLoop(const std::string &name, long long iterator, ExpressionNode *fromValue, ExpressionNode *toValue, CommandsNode *commands, long long step)
+    {
+        auto first = dynamic_cast<ValueNode *>(fromValue);
+        auto last = dynamic_cast<ValueNode *>(toValue);
+        if (!first || !last || LoopAnalysis::containsLoop(commands) || writesThroughCall(commands, name))
+        {
+            return false;
+        }
+
+        long long budget = unrollBudget;
+        if (profile && !commands->commands.empty())
+        {
+            long long iterations = profile->entries(commands->commands.front());
+            if (iterations == 0)
+            {
+                return false;
             }
-            else if (auto fromValue = dynamic_cast<IdentifierNode *>(forToNode->fromValue))
+            if (iterations >= profileHotIterations)
             {
-                auto it = iteratorMemoryMap.find(*fromValue->name);
-                if (fromValue->index)
-                {
-                    generateArrayAccess(fromValue);
-                    loadArrayValue(memoryPointer);
-                }
-                else if (it != iteratorMemoryMap.end())
+                budget *= profileUnrollScale;
+            }
+        }
+
+        long long trips = std::max(0LL, (last->value - first->value) * step + 1);
+        long long growth = (trips - 1) * LoopAnalysis::estimateSize(commands);
+        if (trips < 1 || trips > unrollMaxTrips || (trips - 1) * LoopAnalysis::estimateSize(commands, procedureSizes) > budget ||
+            !withinGrowthBudget(growth))
+        {
+            return false;
+        }
+        codeGrowth += growth;
+
+        auto previousHoisted = hoistedValues;
+        long long hoisted = hoistLoopInvariants({commands}, name, nullptr);
+        bool needsCell = LoopAnalysis::passesToCall(commands, name);
+        for (long long trip = 0; trip < trips; ++trip)
+        {
+            long long value = first->value + trip * step;
+            if (needsCell)
+            {
+                code.emit("SET", value, true);
+                code.emit("STORE", iterator, true);
+            }
+            unrolledIterators[name] = value;
+            generateLoopBody(commands);
+        }
+        unrolledIterators.erase(name);
+        releaseHoisted(hoisted, previousHoisted);
+        return true;
+    }
+
+    void generatePartiallyUnrolledLoop(const std::string &name, long long iterator, long long remaining, CommandsNode *commands, long long step)
+    {
+        long long groups = code.newLabel();
+        long long rest = code.newLabel();
+        long long restLoop = code.newLabel();
+        long long loopEnd = code.newLabel();
+
+        code.emit("LOAD", step > 0 ? remaining : iterator, true);
+        code.emit("SUB", step > 0 ? iterator : remaining, true);
+        code.emitJump("JNEG", loopEnd);
+
+        auto previousHoisted = hoistedValues;
+        long long hoisted = hoistLoopInvariants({commands}, name, nullptr);
+        if (hoisted > 0)
+        {
+            code.emit("LOAD", step > 0 ? remaining : iterator, true);
+            code.emit("SUB", step > 0 ? iterator : remaining, true);
+        }
+
+        code.emit("ADD", code.constantCell(2 - partialUnrollFactor), true);
+        code.emit("STORE", remaining, true);
+        code.emitJump("JPOS", groups);
+        code.emitJump("JUMP", rest);
+
+        code.placeLabel(groups);
+        for (long long copy = 0; copy < partialUnrollFactor; ++copy)
+        {
+            generateLoopBody(commands);
+        }
+        code.emit("LOAD", remaining, true);
+        code.emit("SUB", code.constantCell(partialUnrollFactor), true);
+        code.emit("STORE", remaining, true);
+        code.emitJump("JPOS", groups);
+
+        code.placeLabel(rest);
+        code.emit("ADD", code.constantCell(partialUnrollFactor - 1), true);
+        code.emitJump("JZERO", loopEnd);
+        code.emit("STORE", remaining, true);
+
+        code.placeLabel(restLoop);
+        generateLoopBody(commands);
+        code.emit("LOAD", remaining, true);
+        code.emit("SUB", code.constantCell(1), true);
+        code.emit("STORE", remaining, true);
+        code.emitJump("JPOS", restLoop);
+        code.placeLabel(loopEnd);
+
+        releaseHoisted(hoisted, previousHoisted);
+    }
+
+    void generatePartiallyUnrolledInductionLoop(const std::string &name, long long iterator, long long toValue, CommandsNode *commands,
+                                                long long step, const std::vector<long long> &pointers, long long counter)
+    {
+        long long groups = code.newLabel();
+        long long rest = code.newLabel();
+        long long loopEnd = code.newLabel();
+        long long stepCell = code.constantCell(step);
+        auto advance = [&]()
+        {
+            for (auto pointer : pointers)
+            {
+                if (pointer != counter)
                 {
-                    long long address = getIteratorAddress(*fromValue->name);
-                    instructions.emplace_back("LOAD", address, true);
+                    code.emit("LOAD", pointer, true);
+                    code.emit("ADD", stepCell, true);
+                    code.emit("STORE", pointer, true);
                 }
-                else
+            }
+            code.emit("LOAD", counter, true);
+            code.emit("ADD", stepCell, true);
+            code.emit("STORE", counter, true);
+        };
+
+        code.emit("LOAD", iterator, true);
+        code.emit("SUB", toValue, true);
+        code.emitJump(step > 0 ? "JPOS" : "JNEG", loopEnd);
+
+        long long limit = memoryPointer++;
+        auto previousHoisted = hoistedValues;
+        long long hoisted = hoistLoopInvariants({commands}, name, nullptr);
+
+        code.emit("LOAD", toValue, true);
+        if (counter != iterator)
+        {
+            code.emit("ADD", counter, true);
+            code.emit("SUB", iterator, true);
+        }
+        code.emit("STORE", toValue, true);
+        code.emit("ADD", code.constantCell((2 - partialUnrollFactor) * step), true);
+        code.emit("STORE", limit, true);
+        code.emit("SUB", counter, true);
+        code.emitJump(step > 0 ? "JPOS" : "JNEG", groups);
+        code.emitJump("JUMP", rest);
+
+        code.placeLabel(groups);
+        for (long long copy = 0; copy < partialUnrollFactor; ++copy)
+        {
+            generateLoopBody(commands);
+            advance();
+        }
+        code.emit("SUB", limit, true);
+        code.emitJump(step > 0 ? "JNEG" : "JPOS", groups);
+
+        code.placeLabel(rest);
+        code.emit("LOAD", counter, true);
+        code.emit("SUB", toValue, true);
+        code.emitJump(step > 0 ? "JPOS" : "JNEG", loopEnd);
+        generateLoopBody(commands);
+        advance();
+        code.emitJump("JUMP", rest);
+        code.placeLabel(loopEnd);
+
+        releaseHoisted(hoisted, previousHoisted);
+        memoryPointer--;
+    }
+
+    void generateCountedLoop(const std::string &name, long long iterator, long long toValue, CommandsNode *commands, long long step)
+    {
+        IteratorUsage usage = LoopAnalysis::analyzeIterator(commands, name);
+        auto previousPointers = inductionPointers;
+        auto pointers = generateInductionPointers(name, iterator, usage);
+        bool drivenByPointer = usage.otherUses == 0 && !pointers.empty();
+        bool tripCounter = usage.otherUses == 0 && pointers.empty();
+        long long counter = drivenByPointer ? pointers.front() : iterator;
+        if (!LoopAnalysis::containsLoop(commands) &&
+            LoopAnalysis::estimateSize(commands, procedureSizes) <= partialUnrollMaxSize &&
+            withinGrowthBudget(partialUnrollFactor * LoopAnalysis::estimateSize(commands)))
+        {
+            codeGrowth += partialUnrollFactor * LoopAnalysis::estimateSize(commands);
+            if (tripCounter)
+            {
+                generatePartiallyUnrolledLoop(name, iterator, toValue, commands, step);
+            }
+            else
+            {
+                generatePartiallyUnrolledInductionLoop(name, iterator, toValue, commands, step, pointers, counter);
+            }
+            memoryPointer -= pointers.size();
+            inductionPointers = previousPointers;
+            return;
+        }
+
+        long long stepCell = code.constantCell(step);
+
+        long long loopStart = code.newLabel();
+        long long loopEnd = code.newLabel();
+
+        if (tripCounter)
+        {
+            code.emit("LOAD", step > 0 ? toValue : iterator, true);
+            code.emit("SUB", step > 0 ? iterator : toValue, true);
+            code.emitJump("JNEG", loopEnd);
+            code.emit("ADD", code.constantCell(1), true);
+            code.emit("STORE", toValue, true);
+        }
+        else
+        {
+            code.emit("LOAD", iterator, true);
+            code.emit("SUB", toValue, true);
+            code.emitJump(step > 0 ? "JPOS" : "JNEG", loopEnd);
+            code.emit("LOAD", toValue, true);
+            if (drivenByPointer)
+            {
+                code.emit("ADD", counter, true);
+                code.emit("SUB", iterator, true);
+            }
+            code.emit("ADD", stepCell, true);
+            code.emit("STORE", toValue, true);
+        }
+
+        auto previousHoisted = hoistedValues;
+        long long hoisted = hoistLoopInvariants({commands}, name, nullptr);
+        auto previousPrepared = preparedCalls;
+        prepareLoopCalls(commands);
+
+        code.placeLabel(loopStart);
+        generateLoopBody(commands);
+
+        if (tripCounter)
+        {
+            code.emit("LOAD", toValue, true);
+            code.emit("SUB", code.constantCell(1), true);
+            code.emit("STORE", toValue, true);
+            code.emitJump("JPOS", loopStart);
+        }
+        else
+        {
+            for (auto pointer : pointers)
+            {
+                if (pointer != counter)
                 {
-                    isInitialiazed(fromValue);
-                    long long address = getVariableMemoryAddress(*fromValue->name);
-                    instructions.emplace_back("LOAD", address, true);
+                    code.emit("LOAD", pointer, true);
+                    code.emit("ADD", stepCell, true);
+                    code.emit("STORE", pointer, true);
                 }
             }
-            else if (auto valueNode = dynamic_cast<ValueNode *>(forToNode->fromValue))
-            {
-                instructions.emplace_back("SET", valueNode->value, true);
-            }
+            code.emit("LOAD", counter, true);
+            code.emit("ADD", stepCell, true);
+            code.emit("STORE", counter, true);
+            code.emit("SUB", toValue, true);
+            code.emitJump(step > 0 ? "JNEG" : "JPOS", loopStart);
+        }
+        code.placeLabel(loopEnd);
 
-            instructions.emplace_back("STORE", iterator, true);
+        releaseHoisted(hoisted, previousHoisted);
+        preparedCalls = previousPrepared;
+        memoryPointer -= pointers.size();
+        inductionPointers = previousPointers;
+    }
 
-            if (procedureCalls.back() != "main")
+    void generateForToNode(ForToNode *forToNode)
+    {
+        try
+        {
+            auto procedureName = procedureCalls.back();
+            procedureIterators[procedureName][*forToNode->pidentifier->name] = true;
+
+            allocateIterator(*forToNode->pidentifier->name);
+            long long iterator = getIteratorAddress(*forToNode->pidentifier->name);
+            if (!writesThroughCall(forToNode->commands, *forToNode->pidentifier->name))
             {
-                if (auto rightVar = dynamic_cast<IdentifierNode *>(forToNode->toValue))
-                {
-                    auto address = getProcedureIdentifierAddress(*rightVar->name);
-                    auto it = iteratorMemoryMap.find(*rightVar->name);
-                    if (rightVar->index || (address == 3 || address == 4))
-                    {
-                        if (!rightVar->index)
-                        {
-                            throw std::runtime_error("Misuse of array variable: " + *rightVar->name);
-                        }
-                        else if (address == 3)
-                        {
-                            generateProcedureArrayAccess(rightVar);
-                            loadArrayValue(memoryPointer);
-                        }
-                        else if (address == 4)
-                        {
-                            generateProcedureArgumentsArrayAccess(rightVar);
-                            loadArrayValue(memoryPointer);
-                        }
-                        else
-                        {
-                            throw std::runtime_error("Undeclared array: " + *rightVar->name);
-                        }
-                    }
-                    else if (address == 1)
-                    {
-                        address = getProcedureArgumentAddress(*rightVar->name);
-                        instructions.emplace_back("LOADI", address, true);
-                    }
-                    else if (address == 2)
-                    {
-                        isInitialiazed(rightVar);
-                        address = getProcedureVariableAddress(*rightVar->name);
-                        instructions.emplace_back("LOAD", address, true);
-                    }
-                    else if (it != iteratorMemoryMap.end())
-                    {
-                        long long address = getIteratorAddress(*rightVar->name);
-                        instructions.emplace_back("LOAD", address, true);
-                    }
-                    else
-                    {
-                        throw std::runtime_error("Undeclared variable: " + *rightVar->name);
-                    }
-                }
-                else if (auto valueNode = dynamic_cast<ValueNode *>(forToNode->toValue))
-                {
-                    instructions.emplace_back("SET", valueNode->value, true);
-                }
+                loopRangeStates.back()[*forToNode->pidentifier->name] = ValueRange(rangeOf(forToNode->fromValue).low, rangeOf(forToNode->toValue).high);
             }
-            else if (auto toValue = dynamic_cast<IdentifierNode *>(forToNode->toValue))
+
+            if (!generateUnrolledLoop(*forToNode->pidentifier->name, iterator, forToNode->fromValue, forToNode->toValue, forToNode->commands, 1))
             {
-                auto it = iteratorMemoryMap.find(*toValue->name);
-                if (toValue->index)
-                {
-                    generateArrayAccess(toValue);
-                    loadArrayValue(memoryPointer);
-                }
-                else if (it != iteratorMemoryMap.end())
-                {
-                    long long address = getIteratorAddress(*toValue->name);
-                    instructions.emplace_back("LOAD", address, true);
-                }
-                else
-                {
-                    isInitialiazed(toValue);
-                    long long address = getVariableMemoryAddress(*toValue->name);
-                    instructions.emplace_back("LOAD", address, true);
-                }
+                Operand from = resolveOperand(forToNode->fromValue);
+                loadOperand(from);
+                releaseOperand(from);
+
+                code.emit("STORE", iterator, true);
+
+                Operand to = resolveOperand(forToNode->toValue);
+                loadOperand(to);
+                releaseOperand(to);
+
+                code.emit("STORE", memoryPointer, true);
+                long long toValue = memoryPointer++;
+
+                generateCountedLoop(*forToNode->pidentifier->name, iterator, toValue, forToNode->commands, 1);
+
+                maxMemoryPointer = std::max(maxMemoryPointer, memoryPointer);
+
+                memoryPointer -= 1;
             }
-            else if (auto valueNode = dynamic_cast<ValueNode *>(forToNode->toValue))
+            deallocateIterator(*forToNode->pidentifier->name);
+            procedureIterators[procedureName][*forToNode->pidentifier->name] = false;
+        }
+        catch (const CodeGeneratorError &e)
+        {
+            throw;
+        }
+        catch (const std::runtime_error &e)
+        {
+            throw CodeGeneratorError(e.what(), forToNode->getLineNumber());
+        }
+    }
+
+    void generateForDownToNode(ForDownToNode *forToNode)
+    {
+        try
+        {
+            allocateIterator(*forToNode->pidentifier->name);
+            long long iterator = getIteratorAddress(*forToNode->pidentifier->name);
+            if (!writesThroughCall(forToNode->commands, *forToNode->pidentifier->name))
             {
-                instructions.emplace_back("SET", valueNode->value, true);
+                loopRangeStates.back()[*forToNode->pidentifier->name] = ValueRange(rangeOf(forToNode->toValue).low, rangeOf(forToNode->fromValue).high);
             }
 
-            instructions.emplace_back("STORE", memoryPointer, true);
-            long long toValue = memoryPointer++;
-
-            instructions.emplace_back("LOAD", iterator, true);
-            long long loopStart = instructions.size() - 1;
-            instructions.emplace_back("SUB", toValue, true);
-            instructions.emplace_back("JNEG", 0, true);
-            long long skipLoopJump = instructions.size() - 1;
+            if (!generateUnrolledLoop(*forToNode->pidentifier->name, iterator, forToNode->fromValue, forToNode->toValue, forToNode->commands, -1))
+            {
+                Operand from = resolveOperand(forToNode->fromValue);
+                loadOperand(from);
+                releaseOperand(from);
 
-            generateCommands(forToNode->commands);
+                code.emit("STORE", iterator, true);
 
-            instructions.emplace_back("SET", -1, true);
-            instructions.emplace_back("ADD", iterator, true);
-            instructions.emplace_back("STORE", iterator, true);
+                Operand to = resolveOperand(forToNode->toValue);
+                loadOperand(to);
+                releaseOperand(to);
 
-            instructions.emplace_back("JUMP", loopStart - instructions.size(), true);
+                code.emit("STORE", memoryPointer, true);
+                long long toValue = memoryPointer++;
 
-            long long loopEnd = instructions.size();
-            instructions[skipLoopJump].argument = loopEnd - skipLoopJump;
+                generateCountedLoop(*forToNode->pidentifier->name, iterator, toValue, forToNode->commands, -1);
 
-            maxMemoryPointer = std::max(maxMemoryPointer, memoryPointer);
+                maxMemoryPointer = std::max(maxMemoryPointer, memoryPointer);
 
-            memoryPointer -= 1;
+                memoryPointer -= 1;
+            }
             deallocateIterator(*forToNode->pidentifier->name);
         }
         catch (const CodeGeneratorError &e)
@@ -1465,36 +2824,22 @@ public:
                         {
                             throw std::runtime_error("Misuse of array variable: " + *variable->name);
                         }
-                        else if (address == 3)
-                        {
-                            maxMemoryPointer = std::max(maxMemoryPointer, memoryPointer);
-                            generateProcedureArrayAccess(variable);
-                            instructions.emplace_back("GET", 0, true);
-                            storeArrayValue(memoryPointer);
-                        }
-                        else if (address == 4)
-                        {
-                            maxMemoryPointer = std::max(maxMemoryPointer, memoryPointer);
-                            generateProcedureArgumentsArrayAccess(variable);
-                            instructions.emplace_back("GET", 0, true);
-                            storeArrayValue(memoryPointer);
-                        }
-                        else
-                        {
-                            throw std::runtime_error("Undeclared array: " + *variable->name);
-                        }
+
+                        Operand target = resolveArrayElement(variable, address);
+                        readOperand(target);
+                        releaseOperand(target);
                     }
                     else if (address == 1)
                     {
                         address = getProcedureArgumentAddress(*variable->name);
-                        instructions.emplace_back("GET", 0, true);
-                        instructions.emplace_back("STOREI", address, true);
+                        code.emit("GET", 0, true);
+                        code.emit("STOREI", address, true);
                         initializedVariables[procedureCalls.back()][*variable->name] = true;
                     }
                     else if (address == 2)
                     {
                         address = getProcedureVariableAddress(*variable->name);
-                        instructions.emplace_back("GET", address, true);
+                        code.emit("GET", address, true);
                         initializedVariables[procedureCalls.back()][*variable->name] = true;
                     }
                     else if (it != iteratorMemoryMap.end())
@@ -1509,19 +2854,19 @@ public:
             }
             else if (identifier->index)
             {
-                generateArrayAccess(identifier);
-                instructions.emplace_back("GET", 0, true);
-                storeArrayValue(memoryPointer);
+                Operand target = resolveArrayElement(identifier, 0);
+                readOperand(target);
+                releaseOperand(target);
             }
             else if (it != iteratorMemoryMap.end())
             {
                 long long address = getIteratorAddress(*identifier->name);
-                instructions.emplace_back("GET", address, true);
+                code.emit("GET", address, true);
             }
             else
             {
                 long long address = getVariableMemoryAddress(*identifier->name);
-                instructions.emplace_back("GET", address, true);
+                code.emit("GET", address, true);
                 initializedVariables[procedureCalls.back()][*identifier->name] = true;
             }
         }
@@ -1535,306 +2880,450 @@ public:
         }
     }
 
-    void generateCondition(ConditionNode *condition)
+    Operand resolveArrayElement(IdentifierNode *variable, long long kind)
+    {
+        if (auto iterator = dynamic_cast<IdentifierNode *>(variable->index))
+        {
+            auto pointer = inductionPointers.find({*variable->name, *iterator->name});
+            if (!iterator->index && pointer != inductionPointers.end())
+            {
+                return Operand(Operand::Indirect, pointer->second);
+            }
+        }
+
+        auto hoisted = hoistedValues.find("&" + expressionKey(variable));
+        if (hoisted != hoistedValues.end())
+        {
+            return Operand(Operand::Indirect, hoisted->second);
+        }
+
+        Operand index = resolveOperand(variable->index);
+        if (kind == 0)
+        {
+            if (index.kind == Operand::Constant)
+            {
+                return Operand(Operand::Direct, getArrayOffset(*variable->name) + index.value);
+            }
+            generateArrayAccess(variable);
+        }
+        else if (kind == 3)
+        {
+            if (index.kind == Operand::Constant)
+            {
+                return Operand(Operand::Direct, getProcedureArrayOffset(*variable->name) + index.value);
+            }
+            generateProcedureArrayAccess(variable);
+        }
+        else if (kind == 4)
+        {
+            generateProcedureArgumentsArrayAccess(variable);
+        }
+        else
+        {
+            throw std::runtime_error("Undeclared array: " + *variable->name);
+        }
+        return Operand(Operand::Indirect, memoryPointer++, true);
+    }
+
+    Operand resolveIterator(const std::string &name)
     {
+        auto unrolled = unrolledIterators.find(name);
+        if (unrolled != unrolledIterators.end())
+        {
+            return Operand(Operand::Constant, unrolled->second);
+        }
+        return Operand(Operand::Direct, getIteratorAddress(name));
+    }
+
+    Operand resolveOperand(AstNode *node)
+    {
+        if (auto valueNode = dynamic_cast<ValueNode *>(node))
+        {
+            return Operand(Operand::Constant, valueNode->value);
+        }
+
+        auto variable = dynamic_cast<IdentifierNode *>(node);
+        if (!variable)
+        {
+            throw std::runtime_error("Invalid operand");
+        }
+
         if (procedureCalls.back() != "main")
         {
-            if (auto leftVar = dynamic_cast<IdentifierNode *>(condition->leftValue))
+            auto address = getProcedureIdentifierAddress(*variable->name);
+            auto it = iteratorMemoryMap.find(*variable->name);
+            if (variable->index || (address == 3 || address == 4))
             {
-                auto address = getProcedureIdentifierAddress(*leftVar->name);
-                auto it = iteratorMemoryMap.find(*leftVar->name);
-                if (leftVar->index || (address == 3 || address == 4))
-                {
-                    if (!leftVar->index)
-                    {
-                        throw std::runtime_error("Misuse of array variable: " + *leftVar->name);
-                    }
-                    else if (address == 3)
-                    {
-                        generateProcedureArrayAccess(leftVar);
-                        loadArrayValue(memoryPointer);
-                    }
-                    else if (address == 4)
-                    {
-                        generateProcedureArgumentsArrayAccess(leftVar);
-                        loadArrayValue(memoryPointer);
-                    }
-                    else
-                    {
-                        throw std::runtime_error("Undeclared array: " + *leftVar->name);
-                    }
-                }
-                else if (address == 1)
-                {
-                    address = getProcedureArgumentAddress(*leftVar->name);
-                    instructions.emplace_back("LOADI", address, true);
-                }
-                else if (address == 2)
+                if (!variable->index)
                 {
-                    isInitialiazed(leftVar);
-                    address = getProcedureVariableAddress(*leftVar->name);
-                    instructions.emplace_back("LOAD", address, true);
-                }
-                else if (it != iteratorMemoryMap.end())
-                {
-                    long long address = getIteratorAddress(*leftVar->name);
-                    instructions.emplace_back("LOAD", address, true);
-                }
-                else
-                {
-                    throw std::runtime_error("Undeclared variable: " + *leftVar->name);
+                    throw std::runtime_error("Misuse of array variable: " + *variable->name);
                 }
+                return resolveArrayElement(variable, address);
             }
-            else if (auto valueNode = dynamic_cast<ValueNode *>(condition->leftValue))
+            else if (address == 1)
             {
-                instructions.emplace_back("SET", valueNode->value, true);
+                return Operand(Operand::Indirect, getProcedureArgumentAddress(*variable->name));
             }
-        }
-        else if (auto leftVar = dynamic_cast<IdentifierNode *>(condition->leftValue))
-        {
-            auto it = iteratorMemoryMap.find(*leftVar->name);
-            if (leftVar->index)
+            else if (address == 2)
             {
-                generateArrayAccess(leftVar);
-                loadArrayValue(memoryPointer);
+                isInitialiazed(variable);
+                return Operand(Operand::Direct, getProcedureVariableAddress(*variable->name));
             }
             else if (it != iteratorMemoryMap.end())
             {
-                long long address = getIteratorAddress(*leftVar->name);
-                instructions.emplace_back("LOAD", address, true);
+                return resolveIterator(*variable->name);
             }
-            else
+            throw std::runtime_error("Undeclared variable: " + *variable->name);
+        }
+
+        if (variable->index)
+        {
+            return resolveArrayElement(variable, 0);
+        }
+        else if (iteratorMemoryMap.count(*variable->name))
+        {
+            return resolveIterator(*variable->name);
+        }
+        isInitialiazed(variable);
+        return Operand(Operand::Direct, getVariableMemoryAddress(*variable->name));
+    }
+
+    void loadOperand(const Operand &operand)
+    {
+        if (operand.kind == Operand::Constant)
+        {
+            code.emit("SET", operand.value, true);
+        }
+        else if (operand.kind == Operand::Direct)
+        {
+            code.emit("LOAD", operand.value, true);
+        }
+        else
+        {
+            code.emit("LOADI", operand.value, true);
+        }
+    }
+
+    using Tile = std::vector<std::pair<std::string, Operand>>;
+
+    static std::string tileOperation(const std::string &operation, const Operand &operand)
+    {
+        return operand.kind == Operand::Indirect ? operation + "I" : operation;
+    }
+
+    long long tileCost(const Tile &tile) const
+    {
+        long long cost = 0;
+        for (const auto &[operation, operand] : tile)
+        {
+            cost += instructionCost(tileOperation(operation, operand));
+            if (operand.kind == Operand::Constant && operation != "SET" && !code.hasConstantCell(operand.value) &&
+                code.getLoopDepth() == 0)
             {
-                isInitialiazed(leftVar);
-                long long address = getVariableMemoryAddress(*leftVar->name);
-                instructions.emplace_back("LOAD", address, true);
+                cost += instructionCost("SET") + instructionCost("STORE");
             }
         }
-        else if (auto valueNode = dynamic_cast<ValueNode *>(condition->leftValue))
+        return cost;
+    }
+
+    std::vector<Tile> sumTiles(const Operand &first, const Operand &second, const std::string &operation) const
+    {
+        long long sign = operation == "SUB" ? -1 : 1;
+        if (first.kind == Operand::Constant)
         {
-            instructions.emplace_back("SET", valueNode->value, true);
+            if (operation == "SUB" || first.value != 0)
+            {
+                return {Tile{{"SET", first}, {operation, second}}};
+            }
+            return {Tile{{"LOAD", second}}};
         }
+        if (second.kind != Operand::Constant)
+        {
+            return {Tile{{"LOAD", first}, {operation, second}}};
+        }
+        if (second.value == 0)
+        {
+            return {Tile{{"LOAD", first}}};
+        }
+        return {Tile{{"SET", Operand(Operand::Constant, sign * second.value)}, {"ADD", first}},
+                Tile{{"LOAD", first}, {operation, second}}};
+    }
 
-        instructions.emplace_back("STORE", memoryPointer, true);
-        long long leftTemp = memoryPointer++;
-
-        if (procedureCalls.back() != "main")
+    void emitCheapestTile(const std::vector<Tile> &tiles)
+    {
+        size_t best = 0;
+        for (size_t i = 1; i < tiles.size(); ++i)
         {
-            if (auto rightVar = dynamic_cast<IdentifierNode *>(condition->rightValue))
+            if (tileCost(tiles[i]) < tileCost(tiles[best]))
             {
-                auto address = getProcedureIdentifierAddress(*rightVar->name);
-                auto it = iteratorMemoryMap.find(*rightVar->name);
-                if (rightVar->index || (address == 3 || address == 4))
-                {
-                    if (!rightVar->index)
-                    {
-                        throw std::runtime_error("Misuse of array variable: " + *rightVar->name);
-                    }
-                    else if (address == 3)
-                    {
-                        generateProcedureArrayAccess(rightVar);
-                        loadArrayValue(memoryPointer);
-                    }
-                    else if (address == 4)
-                    {
-                        generateProcedureArgumentsArrayAccess(rightVar);
-                        loadArrayValue(memoryPointer);
-                    }
-                    else
-                    {
-                        throw std::runtime_error("Undeclared array: " + *rightVar->name);
-                    }
-                }
-                else if (address == 1)
-                {
-                    address = getProcedureArgumentAddress(*rightVar->name);
-                    instructions.emplace_back("LOADI", address, true);
-                }
-                else if (address == 2)
-                {
-                    isInitialiazed(rightVar);
-                    address = getProcedureVariableAddress(*rightVar->name);
-                    instructions.emplace_back("LOAD", address, true);
-                }
-                else if (it != iteratorMemoryMap.end())
-                {
-                    long long address = getIteratorAddress(*rightVar->name);
-                    instructions.emplace_back("LOAD", address, true);
-                }
-                else
-                {
-                    throw std::runtime_error("Undeclared variable: " + *rightVar->name);
-                }
+                best = i;
+            }
+        }
+        retiledExpressions += best != 0;
+        for (const auto &[operation, operand] : tiles[best])
+        {
+            if (operation == "SET")
+            {
+                code.emit("SET", operand.value, true);
+            }
+            else if (operand.kind == Operand::Constant)
+            {
+                code.emit(operation, code.constantCell(operand.value), true);
             }
-            else if (auto valueNode = dynamic_cast<ValueNode *>(condition->rightValue))
+            else
             {
-                instructions.emplace_back("SET", valueNode->value, true);
+                code.emit(tileOperation(operation, operand), operand.value, true);
             }
         }
-        else if (auto rightVar = dynamic_cast<IdentifierNode *>(condition->rightValue))
+    }
+
+    void addOperand(const Operand &operand)
+    {
+        if (operand.kind == Operand::Direct)
+        {
+            code.emit("ADD", operand.value, true);
+        }
+        else if (operand.kind == Operand::Indirect)
+        {
+            code.emit("ADDI", operand.value, true);
+        }
+        else if (operand.value != 0)
+        {
+            throw std::runtime_error("Cannot add a constant operand");
+        }
+    }
+
+    void storeOperand(const Operand &operand)
+    {
+        if (operand.kind == Operand::Direct)
+        {
+            code.emit("STORE", operand.value, true);
+        }
+        else if (operand.kind == Operand::Indirect)
+        {
+            code.emit("STOREI", operand.value, true);
+        }
+        else
+        {
+            throw std::runtime_error("Cannot store into a constant operand");
+        }
+    }
+
+    void readOperand(const Operand &operand)
+    {
+        if (operand.kind == Operand::Direct)
+        {
+            code.emit("GET", operand.value, true);
+        }
+        else
+        {
+            code.emit("GET", 0, true);
+            storeOperand(operand);
+        }
+    }
+
+    void writeOperand(const Operand &operand)
+    {
+        if (operand.kind == Operand::Direct)
+        {
+            code.emit("PUT", operand.value, true);
+        }
+        else
+        {
+            loadOperand(operand);
+            code.emit("PUT", 0, true);
+        }
+    }
+
+    long long materializeOperand(const Operand &operand)
+    {
+        loadOperand(operand);
+        code.emit("STORE", memoryPointer, true);
+        return memoryPointer++;
+    }
+
+    void releaseOperand(const Operand &operand)
+    {
+        maxMemoryPointer = std::max(maxMemoryPointer, memoryPointer);
+        if (operand.temporary)
+        {
+            memoryPointer--;
+        }
+    }
+
+    void subtractOperand(const Operand &operand)
+    {
+        if (operand.kind == Operand::Direct)
+        {
+            code.emit("SUB", operand.value, true);
+        }
+        else if (operand.kind == Operand::Indirect)
         {
-            auto it = iteratorMemoryMap.find(*rightVar->name);
-            if (rightVar->index)
-            {
-                generateArrayAccess(rightVar);
-                loadArrayValue(memoryPointer);
-            }
-            else if (it != iteratorMemoryMap.end())
-            {
-                long long address = getIteratorAddress(*rightVar->name);
-                instructions.emplace_back("LOAD", address, true);
-            }
-            else
-            {
-                isInitialiazed(rightVar);
-                long long address = getVariableMemoryAddress(*rightVar->name);
-                instructions.emplace_back("LOAD", address, true);
-            }
+            code.emit("SUBI", operand.value, true);
         }
-        else if (auto valueNode = dynamic_cast<ValueNode *>(condition->rightValue))
+        else if (operand.value != 0)
         {
-            instructions.emplace_back("SET", valueNode->value, true);
+            throw std::runtime_error("Cannot subtract a constant operand");
         }
+    }
 
-        instructions.emplace_back("SUB", leftTemp, true);
+    std::string mirrorComparison(const std::string &operation) const
+    {
+        if (operation == "<")
+            return ">";
+        if (operation == ">")
+            return "<";
+        if (operation == "<=")
+            return ">=";
+        if (operation == ">=")
+            return "<=";
+        return operation;
+    }
 
-        maxMemoryPointer = std::max(maxMemoryPointer, memoryPointer);
-        memoryPointer--;
+    std::string generateCondition(ConditionNode *condition)
+    {
+        Operand left = resolveOperand(condition->leftValue);
+        Operand right = resolveOperand(condition->rightValue);
+        std::string operation = condition->operation;
+
+        if (left.kind == Operand::Constant && right.kind == Operand::Constant)
+        {
+            code.emit("SET", right.value - left.value, true);
+        }
+        else if (left.kind == Operand::Constant && left.value == 0)
+        {
+            loadOperand(right);
+        }
+        else if (left.kind == Operand::Constant || (left.kind == Operand::Direct && right.kind == Operand::Indirect) ||
+                 (right.kind == Operand::Constant && right.value == 0))
+        {
+            loadOperand(left);
+            subtractOperand(right);
+            operation = mirrorComparison(operation);
+        }
+        else
+        {
+            loadOperand(right);
+            subtractOperand(left);
+        }
+
+        releaseOperand(right);
+        releaseOperand(left);
+        return operation;
     }
 
     void generateIfCommand(IfNode *ifNode)
     {
         try
         {
-            generateCondition(ifNode->condition);
+            std::string operation = generateCondition(ifNode->condition);
 
-            if (ifNode->condition->operation == "=")
+            if (operation == "=")
             {
-                instructions.emplace_back("JZERO", 0, true);
-                long long condJumpLoc = instructions.size() - 1;
+                long long thenBlock = code.newLabel();
+                long long endThenBlock = code.newLabel();
+                code.emitJump("JZERO", thenBlock);
 
                 if (ifNode->elseCommands)
                 {
-                    generateCommands(ifNode->elseCommands);
+                    generateIfArm(ifNode, false);
                 }
-                long long endElseBlock = instructions.size();
-                instructions.emplace_back("JUMP", 0, true);
-                long long skipElseJump = instructions.size() - 1;
-
-                generateCommands(ifNode->thenCommands);
-                long long endThenBlock = instructions.size();
+                code.emitJump("JUMP", endThenBlock);
 
-                instructions[condJumpLoc].argument = endElseBlock - condJumpLoc + 1;
-                instructions[skipElseJump].argument = endThenBlock - skipElseJump;
+                code.placeLabel(thenBlock);
+                generateIfArm(ifNode, true);
+                code.placeLabel(endThenBlock);
             }
-            else if (ifNode->condition->operation == "!=")
+            else if (operation == "!=")
             {
-                instructions.emplace_back("JZERO", 0, true);
-                long long condJumpLoc = instructions.size() - 1;
+                long long elseBlock = code.newLabel();
+                long long endElseBlock = code.newLabel();
+                code.emitJump("JZERO", elseBlock);
 
-                generateCommands(ifNode->thenCommands);
+                generateIfArm(ifNode, true);
 
-                long long endThenBlock = instructions.size();
-                long long skipThenJump;
                 if (ifNode->elseCommands)
                 {
-                    endThenBlock = instructions.size();
-                    instructions.emplace_back("JUMP", 0, true);
-                    skipThenJump = instructions.size() - 1;
-                    generateCommands(ifNode->elseCommands);
-                    long long endElseBlock = instructions.size();
-                    instructions[skipThenJump].argument = endElseBlock - skipThenJump;
-                    instructions[condJumpLoc].argument = endThenBlock - condJumpLoc + 1;
+                    code.emitJump("JUMP", endElseBlock);
+                    code.placeLabel(elseBlock);
+                    generateIfArm(ifNode, false);
+                    code.placeLabel(endElseBlock);
                 }
                 else
                 {
-                    instructions[condJumpLoc].argument = endThenBlock - condJumpLoc;
+                    code.placeLabel(elseBlock);
                 }
             }
-            else if (ifNode->condition->operation == ">")
+            else if (operation == ">")
             {
-                instructions.emplace_back("JNEG", 0, true);
-                long long condJumpLoc = instructions.size() - 1;
+                long long thenBlock = code.newLabel();
+                long long endThenBlock = code.newLabel();
+                code.emitJump("JNEG", thenBlock);
 
                 if (ifNode->elseCommands)
                 {
-                    generateCommands(ifNode->elseCommands);
+                    generateIfArm(ifNode, false);
                 }
-                long long endElseBlock = instructions.size();
-                instructions.emplace_back("JUMP", 0, true);
-                long long skipElseJump = instructions.size() - 1;
+                code.emitJump("JUMP", endThenBlock);
 
-                generateCommands(ifNode->thenCommands);
-                long long endThenBlock = instructions.size();
-
-                instructions[condJumpLoc].argument = endElseBlock - condJumpLoc + 1;
-                instructions[skipElseJump].argument = endThenBlock - skipElseJump;
+                code.placeLabel(thenBlock);
+                generateIfArm(ifNode, true);
+                code.placeLabel(endThenBlock);
             }
-            else if (ifNode->condition->operation == "<")
+            else if (operation == "<")
             {
-                instructions.emplace_back("JPOS", 0, true);
-                long long condJumpLoc = instructions.size() - 1;
+                long long thenBlock = code.newLabel();
+                long long endThenBlock = code.newLabel();
+                code.emitJump("JPOS", thenBlock);
 
                 if (ifNode->elseCommands)
                 {
-                    generateCommands(ifNode->elseCommands);
+                    generateIfArm(ifNode, false);
                 }
-                long long endElseBlock = instructions.size();
-                instructions.emplace_back("JUMP", 0, true);
-                long long skipElseJump = instructions.size() - 1;
-
-                generateCommands(ifNode->thenCommands);
-                long long endThenBlock = instructions.size();
+                code.emitJump("JUMP", endThenBlock);
 
-                instructions[condJumpLoc].argument = endElseBlock - condJumpLoc + 1;
-                instructions[skipElseJump].argument = endThenBlock - skipElseJump;
+                code.placeLabel(thenBlock);
+                generateIfArm(ifNode, true);
+                code.placeLabel(endThenBlock);
             }
-            else if (ifNode->condition->operation == ">=")
+            else if (operation == ">=")
             {
-                instructions.emplace_back("JPOS", 0, true);
-                long long condJumpLoc = instructions.size() - 1;
+                long long elseBlock = code.newLabel();
+                long long endElseBlock = code.newLabel();
+                code.emitJump("JPOS", elseBlock);
 
-                generateCommands(ifNode->thenCommands);
+                generateIfArm(ifNode, true);
 
-                long long endThenBlock = instructions.size();
-                long long skipThenJump;
                 if (ifNode->elseCommands)
                 {
-                    endThenBlock = instructions.size();
-                    instructions.emplace_back("JUMP", 0, true);
-                    skipThenJump = instructions.size() - 1;
-                    generateCommands(ifNode->elseCommands);
-                    long long endElseBlock = instructions.size();
-                    instructions[skipThenJump].argument = endElseBlock - skipThenJump;
-                    instructions[condJumpLoc].argument = endThenBlock - condJumpLoc + 1;
+                    code.emitJump("JUMP", endElseBlock);
+                    code.placeLabel(elseBlock);
+                    generateIfArm(ifNode, false);
+                    code.placeLabel(endElseBlock);
                 }
                 else
                 {
-                    instructions[condJumpLoc].argument = endThenBlock - condJumpLoc;
+                    code.placeLabel(elseBlock);
                 }
             }
-            else if (ifNode->condition->operation == "<=")
+            else if (operation == "<=")
             {
-                instructions.emplace_back("JNEG", 0, true);
-                long long condJumpLoc = instructions.size() - 1;
+                long long elseBlock = code.newLabel();
+                long long endElseBlock = code.newLabel();
+                code.emitJump("JNEG", elseBlock);
 
-                generateCommands(ifNode->thenCommands);
+                generateIfArm(ifNode, true);
 
-                long long endThenBlock = instructions.size();
-                long long skipThenJump;
                 if (ifNode->elseCommands)
                 {
-                    endThenBlock = instructions.size();
-                    instructions.emplace_back("JUMP", 0, true);
-                    skipThenJump = instructions.size() - 1;
-                    generateCommands(ifNode->elseCommands);
-                    long long endElseBlock = instructions.size();
-                    instructions[skipThenJump].argument = endElseBlock - skipThenJump;
-                    instructions[condJumpLoc].argument = endThenBlock - condJumpLoc + 1;
+                    code.emitJump("JUMP", endElseBlock);
+                    code.placeLabel(elseBlock);
+                    generateIfArm(ifNode, false);
+                    code.placeLabel(endElseBlock);
                 }
                 else
                 {
-                    instructions[condJumpLoc].argument = endThenBlock - condJumpLoc;
+                    code.placeLabel(elseBlock);
                 }
             }
         }
@@ -1867,41 +3356,26 @@ public:
                         {
                             throw std::runtime_error("Misuse of array variable: " + *variable->name);
                         }
-                        else if (address == 3)
-                        {
-                            maxMemoryPointer = std::max(maxMemoryPointer, memoryPointer);
-                            generateProcedureArrayAccess(variable);
-                            loadArrayValue(memoryPointer);
-                            instructions.emplace_back("PUT", 0, true);
-                        }
-                        else if (address == 4)
-                        {
-                            maxMemoryPointer = std::max(maxMemoryPointer, memoryPointer);
-                            generateProcedureArgumentsArrayAccess(variable);
-                            loadArrayValue(memoryPointer);
-                            instructions.emplace_back("PUT", 0, true);
-                        }
-                        else
-                        {
-                            throw std::runtime_error("Undeclared array: " + *variable->name);
-                        }
+
+                        Operand source = resolveArrayElement(variable, address);
+                        writeOperand(source);
+                        releaseOperand(source);
                     }
                     else if (address == 1)
                     {
                         address = getProcedureArgumentAddress(*variable->name);
-                        instructions.emplace_back("LOADI", address, true);
-                        instructions.emplace_back("PUT", 0, true);
+                        code.emit("LOADI", address, true);
+                        code.emit("PUT", 0, true);
                     }
                     else if (address == 2)
                     {
                         isInitialiazed(variable);
                         address = getProcedureVariableAddress(*variable->name);
-                        instructions.emplace_back("PUT", address, true);
+                        code.emit("PUT", address, true);
                     }
                     else if (it != iteratorMemoryMap.end())
                     {
-                        long long address = getIteratorAddress(*variable->name);
-                        instructions.emplace_back("PUT", address, true);
+                        writeOperand(resolveIterator(*variable->name));
                     }
                     else
                     {
@@ -1914,26 +3388,25 @@ public:
                 auto it = iteratorMemoryMap.find(*variable->name);
                 if (variable->index)
                 {
-                    generateArrayAccess(variable);
-                    loadArrayValue(memoryPointer);
-                    instructions.emplace_back("PUT", 0, true);
+                    Operand source = resolveArrayElement(variable, 0);
+                    writeOperand(source);
+                    releaseOperand(source);
                 }
                 else if (it != iteratorMemoryMap.end())
                 {
-                    long long address = getIteratorAddress(*variable->name);
-                    instructions.emplace_back("PUT", address, true);
+                    writeOperand(resolveIterator(*variable->name));
                 }
                 else
                 {
                     isInitialiazed(variable);
                     long long address = getVariableMemoryAddress(*variable->name);
-                    instructions.emplace_back("PUT", address, true);
+                    code.emit("PUT", address, true);
                 }
             }
             else if (auto valueNode = dynamic_cast<ValueNode *>(writeNode->value))
             {
-                instructions.emplace_back("SET", valueNode->value, true);
-                instructions.emplace_back("PUT", 0, true);
+                code.emit("SET", valueNode->value, true);
+                code.emit("PUT", 0, true);
             }
         }
         catch (const CodeGeneratorError &e)
@@ -1962,43 +3435,24 @@ public:
                         {
                             throw std::runtime_error("Misuse of array variable: " + *variable->name);
                         }
-                        else if (address == 3)
-                        {
-                            generateProcedureArrayAccess(variable);
-                            long long temp = memoryPointer++;
-                            generateExpression(assignNode->expression);
-                            storeArrayValue(temp);
-                            maxMemoryPointer = std::max(maxMemoryPointer, memoryPointer);
-
-                            memoryPointer--;
-                        }
-                        else if (address == 4)
-                        {
-                            generateProcedureArgumentsArrayAccess(variable);
-                            long long temp = memoryPointer++;
-                            generateExpression(assignNode->expression);
-                            storeArrayValue(temp);
-                            maxMemoryPointer = std::max(maxMemoryPointer, memoryPointer);
 
-                            memoryPointer--;
-                        }
-                        else
-                        {
-                            throw std::runtime_error("Undeclared array: " + *variable->name);
-                        }
+                        Operand target = resolveArrayElement(variable, address);
+                        generateExpression(assignNode->expression);
+                        storeOperand(target);
+                        releaseOperand(target);
                     }
                     else if (address == 1)
                     {
                         generateExpression(assignNode->expression);
                         address = getProcedureArgumentAddress(*variable->name);
-                        instructions.emplace_back("STOREI", address, true);
+                        code.emit("STOREI", address, true);
                         initializedVariables[procedureCalls.back()][*variable->name] = true;
                     }
                     else if (address == 2)
                     {
                         generateExpression(assignNode->expression);
                         address = getProcedureVariableAddress(*variable->name);
-                        instructions.emplace_back("STORE", address, true);
+                        code.emit("STORE", address, true);
                         initializedVariables[procedureCalls.back()][*variable->name] = true;
                     }
                     else if (it != iteratorMemoryMap.end())
@@ -2016,13 +3470,10 @@ public:
                 auto it = iteratorMemoryMap.find(*variable->name);
                 if (variable->index)
                 {
-                    generateArrayAccess(variable);
-                    long long temp = memoryPointer++;
+                    Operand target = resolveArrayElement(variable, 0);
                     generateExpression(assignNode->expression);
-                    storeArrayValue(temp);
-                    maxMemoryPointer = std::max(maxMemoryPointer, memoryPointer);
-
-                    memoryPointer--;
+                    storeOperand(target);
+                    releaseOperand(target);
                 }
                 else if (it != iteratorMemoryMap.end())
                 {
@@ -2032,7 +3483,7 @@ public:
                 {
                     generateExpression(assignNode->expression);
                     long long address = getVariableMemoryAddress(*variable->name);
-                    instructions.emplace_back("STORE", address, true);
+                    code.emit("STORE", address, true);
                     initializedVariables[procedureCalls.back()][*variable->name] = true;
                 }
             }
@@ -2051,453 +3502,226 @@ public:
     {
         try
         {
-            if (auto binaryExpr = dynamic_cast<BinaryExpressionNode *>(expression))
+            auto hoisted = hoistedValues.find(expressionKey(expression));
+            auto available = availableValues.find(valueKey(expression));
+            if (hoisted != hoistedValues.end())
             {
-                bool isLeftArray = false;
-                if (procedureCalls.back() != "main")
-                {
-                    if (auto leftVar = dynamic_cast<IdentifierNode *>(binaryExpr->left))
-                    {
-                        auto address = getProcedureIdentifierAddress(*leftVar->name);
-                        auto it = iteratorMemoryMap.find(*leftVar->name);
-                        if (leftVar->index || (address == 3 || address == 4))
-                        {
-                            if (!leftVar->index)
-                            {
-                                throw std::runtime_error("Misuse of array variable: " + *leftVar->name);
-                            }
-                            else if (address == 3)
-                            {
-                                generateProcedureArrayAccess(leftVar);
-                                isLeftArray = true;
-                            }
-                            else if (address == 4)
-                            {
-                                generateProcedureArgumentsArrayAccess(leftVar);
-                                isLeftArray = true;
-                            }
-                            else
-                            {
-                                throw std::runtime_error("Undeclared array: " + *leftVar->name);
-                            }
-                        }
-                        else if (address == 1)
-                        {
-                            address = getProcedureArgumentAddress(*leftVar->name);
-                            instructions.emplace_back("LOADI", address, true);
-                            instructions.emplace_back("STORE", memoryPointer, true);
-                        }
-                        else if (address == 2)
-                        {
-                            isInitialiazed(leftVar);
-                            address = getProcedureVariableAddress(*leftVar->name);
-                            instructions.emplace_back("LOAD", address, true);
-                            instructions.emplace_back("STORE", memoryPointer, true);
-                        }
-                        else if (it != iteratorMemoryMap.end())
-                        {
-                            long long address = getIteratorAddress(*leftVar->name);
-                            instructions.emplace_back("LOAD", address, true);
-                            instructions.emplace_back("STORE", memoryPointer, true);
-                        }
-                        else
-                        {
-                            throw std::runtime_error("Undefined variable : " + *leftVar->name);
-                        }
-                    }
-                    else if (auto valueNode = dynamic_cast<ValueNode *>(binaryExpr->left))
-                    {
-                        instructions.emplace_back("SET", valueNode->value, true);
-                        instructions.emplace_back("STORE", memoryPointer, true);
-                    }
-                }
-                else if (auto leftVar = dynamic_cast<IdentifierNode *>(binaryExpr->left))
-                {
-                    auto it = iteratorMemoryMap.find(*leftVar->name);
-                    if (leftVar->index)
-                    {
-                        generateArrayAccess(leftVar);
-                        isLeftArray = true;
-                    }
-                    else if (it != iteratorMemoryMap.end())
-                    {
-                        long long address = getIteratorAddress(*leftVar->name);
-                        instructions.emplace_back("LOAD", address, true);
-                        instructions.emplace_back("STORE", memoryPointer, true);
-                    }
-                    else
-                    {
-                        isInitialiazed(leftVar);
-                        long long address = getVariableMemoryAddress(*leftVar->name);
-                        instructions.emplace_back("LOAD", address, true);
-                        instructions.emplace_back("STORE", memoryPointer, true);
-                    }
-                }
-                else if (auto valueNode = dynamic_cast<ValueNode *>(binaryExpr->left))
-                {
-                    instructions.emplace_back("SET", valueNode->value, true);
-                    instructions.emplace_back("STORE", memoryPointer, true);
-                }
-
-                long long leftTemp = memoryPointer++;
-
-                bool isRightArray = false;
-                if (procedureCalls.back() != "main")
-                {
-                    if (auto rightVar = dynamic_cast<IdentifierNode *>(binaryExpr->right))
-                    {
-                        auto address = getProcedureIdentifierAddress(*rightVar->name);
-                        auto it = iteratorMemoryMap.find(*rightVar->name);
-                        if (rightVar->index || (address == 3 || address == 4))
-                        {
-                            if (!rightVar->index)
-                            {
-                                throw std::runtime_error("Misuse of array variable: " + *rightVar->name);
-                            }
-                            else if (address == 3)
-                            {
-                                generateProcedureArrayAccess(rightVar);
-                                isRightArray = true;
-                            }
-                            else if (address == 4)
-                            {
-                                generateProcedureArgumentsArrayAccess(rightVar);
-                                isRightArray = true;
-                            }
-                            else
-                            {
-                                throw std::runtime_error("Undeclared array: " + *rightVar->name);
-                            }
-                        }
-                        else if (address == 1)
-                        {
-                            address = getProcedureArgumentAddress(*rightVar->name);
-                            instructions.emplace_back("LOADI", address, true);
-                            instructions.emplace_back("STORE", memoryPointer, true);
-                        }
-                        else if (address == 2)
-                        {
-                            isInitialiazed(rightVar);
-                            address = getProcedureVariableAddress(*rightVar->name);
-                            instructions.emplace_back("LOAD", address, true);
-                            instructions.emplace_back("STORE", memoryPointer, true);
-                        }
-                        else if (it != iteratorMemoryMap.end())
-                        {
-                            long long address = getIteratorAddress(*rightVar->name);
-                            instructions.emplace_back("LOAD", address, true);
-                            instructions.emplace_back("STORE", memoryPointer, true);
-                        }
-                        else
-                        {
-                            throw std::runtime_error("Undefined variable : " + *rightVar->name);
-                        }
-                    }
-                    else if (auto valueNode = dynamic_cast<ValueNode *>(binaryExpr->right))
-                    {
-                        instructions.emplace_back("SET", valueNode->value, true);
-                        instructions.emplace_back("STORE", memoryPointer, true);
-                    }
-                }
-                else if (auto rightVar = dynamic_cast<IdentifierNode *>(binaryExpr->right))
-                {
-                    auto it = iteratorMemoryMap.find(*rightVar->name);
-                    if (rightVar->index)
-                    {
-                        generateArrayAccess(rightVar);
-                        isRightArray = true;
-                    }
-                    else if (it != iteratorMemoryMap.end())
-                    {
-                        long long address = getIteratorAddress(*rightVar->name);
-                        instructions.emplace_back("LOAD", address, true);
-                        instructions.emplace_back("STORE", memoryPointer, true);
-                    }
-                    else
-                    {
-                        isInitialiazed(rightVar);
-                        long long address = getVariableMemoryAddress(*rightVar->name);
-                        instructions.emplace_back("LOAD", address, true);
-                        instructions.emplace_back("STORE", memoryPointer, true);
-                    }
-                }
-                else if (auto valueNode = dynamic_cast<ValueNode *>(binaryExpr->right))
-                {
-                    instructions.emplace_back("SET", valueNode->value, true);
-                    instructions.emplace_back("STORE", memoryPointer, true);
-                }
-
-                long long rightTemp = memoryPointer++;
+                code.emit("LOAD", hoisted->second, true);
+            }
+            else if (available != availableValues.end())
+            {
+                code.emit("LOAD", available->second.first, true);
+                reusedValues++;
+            }
+            else if (auto binaryExpr = dynamic_cast<BinaryExpressionNode *>(expression))
+            {
+                Operand left = resolveOperand(binaryExpr->left);
+                Operand right = resolveOperand(binaryExpr->right);
 
                 if (binaryExpr->operation == "+")
                 {
-                    if (isLeftArray && isRightArray)
-                    {
-                        loadArrayValue(leftTemp);
-                        instructions.emplace_back("ADDI", rightTemp, true);
-                    }
-                    else if (isLeftArray)
-                    {
-                        loadArrayValue(leftTemp);
-                        instructions.emplace_back("ADD", rightTemp, true);
-                    }
-                    else if (isRightArray)
+                    if (left.kind == Operand::Constant && right.kind == Operand::Constant)
                     {
-                        loadArrayValue(rightTemp);
-                        instructions.emplace_back("ADD", leftTemp, true);
+                        code.emit("SET", left.value + right.value, true);
                     }
                     else
                     {
-                        instructions.emplace_back("ADD", leftTemp, true);
+                        auto tiles = sumTiles(left, right, "ADD");
+                        auto swapped = sumTiles(right, left, "ADD");
+                        tiles.insert(tiles.end(), swapped.begin(), swapped.end());
+                        emitCheapestTile(tiles);
                     }
-
-                    maxMemoryPointer = std::max(maxMemoryPointer, memoryPointer);
-
-                    memoryPointer -= 2;
                 }
                 else if (binaryExpr->operation == "-")
                 {
-                    if (isLeftArray && isRightArray)
-                    {
-                        loadArrayValue(leftTemp);
-                        instructions.emplace_back("SUBI", rightTemp, true);
-                    }
-                    else if (isLeftArray)
-                    {
-                        loadArrayValue(leftTemp);
-                        instructions.emplace_back("SUB", rightTemp, true);
-                    }
-                    else if (isRightArray)
+                    if (left.kind == Operand::Constant && right.kind == Operand::Constant)
                     {
-                        instructions.emplace_back("LOAD", leftTemp, true);
-                        instructions.emplace_back("SUBI", rightTemp, true);
+                        code.emit("SET", left.value - right.value, true);
                     }
                     else
                     {
-                        instructions.emplace_back("LOAD", leftTemp, true);
-                        instructions.emplace_back("SUB", rightTemp, true);
+                        emitCheapestTile(sumTiles(left, right, "SUB"));
                     }
-                    maxMemoryPointer = std::max(maxMemoryPointer, memoryPointer);
-
-                    memoryPointer -= 2;
                 }
                 else if (binaryExpr->operation == "*")
                 {
-                    long long leftValue, rightValue;
-                    handleArrayValues(isLeftArray, isRightArray, leftTemp, rightTemp, leftValue, rightValue);
+                    bool leftNonNegative = rangeOf(binaryExpr->left).nonNegative();
+                    bool rightNonNegative = rangeOf(binaryExpr->right).nonNegative();
+                    long long leftValue = materializeOperand(left);
+                    long long rightValue = materializeOperand(right);
 
                     long long resultTemp, signTemp;
-                    initializeResultAndSign(resultTemp, signTemp);
+                    initializeResultAndSign(resultTemp, signTemp, !leftNonNegative || !rightNonNegative);
 
-                    handleOperandSign(leftValue, signTemp, true);
-                    handleOperandSign(rightValue, signTemp, false);
+                    bool withSign = handleOperandSigns(leftValue, rightValue, signTemp, leftNonNegative, rightNonNegative);
 
                     performMultiplication(leftValue, rightValue, resultTemp);
-                    applySign(resultTemp, signTemp);
+                    if (withSign)
+                    {
+                        applySign(resultTemp, signTemp);
+                    }
+                    else
+                    {
+                        code.emit("LOAD", resultTemp, true);
+                    }
 
                     maxMemoryPointer = std::max(maxMemoryPointer, memoryPointer);
 
                     memoryPointer -= 4;
-                    if (isLeftArray)
-                        memoryPointer--;
-                    if (isRightArray)
-                        memoryPointer--;
                 }
                 else if (binaryExpr->operation == "/")
                 {
-                    long long leftValue, rightValue;
-                    handleArrayValues(isLeftArray, isRightArray, leftTemp, rightTemp, leftValue, rightValue);
+                    bool leftNonNegative = rangeOf(binaryExpr->left).nonNegative();
+                    bool rightNonNegative = rangeOf(binaryExpr->right).nonNegative();
+                    long long leftValue = materializeOperand(left);
+                    long long rightValue = materializeOperand(right);
 
-                    instructions.emplace_back("LOAD", rightValue, true);
-                    instructions.emplace_back("JZERO", 38, true);
+                    long long zeroDivisorJump = code.newLabel();
+                    if (!rangeOf(binaryExpr->right).excludesZero())
+                    {
+                        code.emit("LOAD", rightValue, true);
+                        code.emitJump("JZERO", zeroDivisorJump);
+                    }
+                    else
+                    {
+                        elidedGuards++;
+                    }
 
                     long long resultTemp, signTemp;
-                    initializeResultAndSign(resultTemp, signTemp);
+                    initializeResultAndSign(resultTemp, signTemp, !leftNonNegative || !rightNonNegative);
 
-                    handleOperandSign(leftValue, signTemp, true);
-                    handleOperandSign(rightValue, signTemp, false);
+                    bool withSign = handleOperandSigns(leftValue, rightValue, signTemp, leftNonNegative, rightNonNegative);
 
                     performDivision(leftValue, rightValue, resultTemp);
-                    applySign(resultTemp, signTemp);
+                    if (withSign)
+                    {
+                        applySign(resultTemp, signTemp);
+                    }
+                    else
+                    {
+                        code.emit("LOAD", resultTemp, true);
+                    }
+                    code.placeLabel(zeroDivisorJump);
 
                     maxMemoryPointer = std::max(maxMemoryPointer, memoryPointer);
 
                     memoryPointer -= 6;
-                    if (isLeftArray)
-                        memoryPointer--;
-                    if (isRightArray)
-                        memoryPointer--;
                 }
                 else if (binaryExpr->operation == "%")
                 {
-                    long long leftValue, rightValue;
-                    handleArrayValues(isLeftArray, isRightArray, leftTemp, rightTemp, leftValue, rightValue);
+                    bool leftNonNegative = rangeOf(binaryExpr->left).nonNegative();
+                    bool rightNonNegative = rangeOf(binaryExpr->right).nonNegative();
+                    long long leftValue = materializeOperand(left);
+                    long long rightValue = materializeOperand(right);
 
-                    instructions.emplace_back("LOAD", rightValue, true);
-                    instructions.emplace_back("JZERO", 55, true);
-
-                    instructions.emplace_back("LOAD", leftValue, true);
-                    instructions.emplace_back("JZERO", 53, true);
-
-                    instructions.emplace_back("SET", 0, true);
-                    instructions.emplace_back("SUB", leftValue, true);
-                    instructions.emplace_back("JPOS", 4, true);
-
-                    instructions.emplace_back("SET", 1, true);
-                    instructions.emplace_back("STORE", memoryPointer, true);
-                    instructions.emplace_back("JUMP", 4, true);
+                    long long remainderEnd = code.newLabel();
+                    for (auto [operand, value] : {std::make_pair(binaryExpr->right, rightValue), std::make_pair(binaryExpr->left, leftValue)})
+                    {
+                        if (!rangeOf(operand).excludesZero())
+                        {
+                            code.emit("LOAD", value, true);
+                            code.emitJump("JZERO", remainderEnd);
+                        }
+                        else
+                        {
+                            elidedGuards++;
+                        }
+                    }
 
-                    instructions.emplace_back("STORE", leftValue, true);
-                    instructions.emplace_back("SET", -1, true);
-                    instructions.emplace_back("STORE", memoryPointer, true);
                     long long leftSign = memoryPointer++;
+                    if (!leftNonNegative)
+                    {
+                        long long leftNegative = code.newLabel();
+                        long long leftSignDone = code.newLabel();
+                        code.emit("SET", 0, true);
+                        code.emit("SUB", leftValue, true);
+                        code.emitJump("JPOS", leftNegative);
 
-                    instructions.emplace_back("SET", 0, true);
-                    instructions.emplace_back("SUB", rightValue, true);
-                    instructions.emplace_back("JPOS", 4, true);
+                        code.emit("SET", 1, true);
+                        code.emit("STORE", leftSign, true);
+                        code.emitJump("JUMP", leftSignDone);
 
-                    instructions.emplace_back("SET", 1, true);
-                    instructions.emplace_back("STORE", memoryPointer, true);
-                    instructions.emplace_back("JUMP", 4, true);
+                        code.placeLabel(leftNegative);
+                        code.emit("STORE", leftValue, true);
+                        code.emit("SET", -1, true);
+                        code.emit("STORE", leftSign, true);
+                        code.placeLabel(leftSignDone);
+                    }
 
-                    instructions.emplace_back("STORE", rightValue, true);
-                    instructions.emplace_back("SET", -1, true);
-                    instructions.emplace_back("STORE", memoryPointer, true);
                     long long rightSign = memoryPointer++;
+                    if (!rightNonNegative)
+                    {
+                        long long rightNegative = code.newLabel();
+                        long long rightSignDone = code.newLabel();
+                        code.emit("SET", 0, true);
+                        code.emit("SUB", rightValue, true);
+                        code.emitJump("JPOS", rightNegative);
 
-                    instructions.emplace_back("LOAD", rightValue, true);
-                    instructions.emplace_back("STORE", memoryPointer, true);
-                    long long currentDivisor = memoryPointer++;
-
-                    instructions.emplace_back("LOAD", leftValue, true);
-                    instructions.emplace_back("SUB", rightValue, true);
-                    instructions.emplace_back("JNEG", 17, true);
-
-                    instructions.emplace_back("LOAD", leftValue, true);
-                    instructions.emplace_back("SUB", currentDivisor, true);
-                    instructions.emplace_back("JNEG", 5, true);
-
-                    instructions.emplace_back("LOAD", currentDivisor, true);
-                    instructions.emplace_back("ADD", currentDivisor, true);
-                    instructions.emplace_back("STORE", currentDivisor, true);
-
-                    instructions.emplace_back("JUMP", -6, true);
-
-                    instructions.emplace_back("LOAD", currentDivisor, true);
-                    instructions.emplace_back("HALF", 0, false);
-                    instructions.emplace_back("STORE", currentDivisor, true);
-
-                    instructions.emplace_back("LOAD", leftValue, true);
-                    instructions.emplace_back("SUB", currentDivisor, true);
-                    instructions.emplace_back("STORE", leftValue, true);
-
-                    instructions.emplace_back("LOAD", rightValue, true);
-                    instructions.emplace_back("STORE", currentDivisor, true);
-
-                    instructions.emplace_back("JUMP", -18, true);
-
-                    instructions.emplace_back("LOAD", leftValue, true);
-                    instructions.emplace_back("JZERO", 12, true);
-
-                    instructions.emplace_back("LOAD", leftSign, true);
-                    instructions.emplace_back("JPOS", 4, true);
-                    instructions.emplace_back("LOAD", rightValue, true);
-                    instructions.emplace_back("SUB", leftValue, true);
-                    instructions.emplace_back("STORE", leftValue, true);
-
-                    instructions.emplace_back("LOAD", rightSign, true);
-                    instructions.emplace_back("JPOS", 4, true);
-                    instructions.emplace_back("LOAD", leftValue, true);
-                    instructions.emplace_back("SUB", rightValue, true);
-                    instructions.emplace_back("STORE", leftValue, true);
-
-                    instructions.emplace_back("LOAD", leftValue, true);
-
-                    maxMemoryPointer = std::max(maxMemoryPointer, memoryPointer);
+                        code.emit("SET", 1, true);
+                        code.emit("STORE", rightSign, true);
+                        code.emitJump("JUMP", rightSignDone);
 
-                    memoryPointer -= 5;
-                    if (isLeftArray)
-                        memoryPointer--;
-                    if (isRightArray)
-                        memoryPointer--;
-                }
-            }
-            else if (procedureCalls.back() != "main")
-            {
-                if (auto variable = dynamic_cast<IdentifierNode *>(expression))
-                {
-                    auto it = iteratorMemoryMap.find(*variable->name);
-                    auto address = getProcedureIdentifierAddress(*variable->name);
-                    if (variable->index || (address == 3 || address == 4))
-                    {
-                        if (!variable->index)
-                        {
-                            throw std::runtime_error("Misuse of array variable: " + *variable->name);
-                        }
-                        else if (address == 3)
-                        {
-                            generateProcedureArrayAccess(variable);
-                            loadArrayValue(memoryPointer);
-                        }
-                        else if (address == 4)
-                        {
-                            generateProcedureArgumentsArrayAccess(variable);
-                            loadArrayValue(memoryPointer);
-                        }
-                        else
-                        {
-                            throw std::runtime_error("Undeclared array: " + *variable->name);
-                        }
+                        code.placeLabel(rightNegative);
+                        code.emit("STORE", rightValue, true);
+                        code.emit("SET", -1, true);
+                        code.emit("STORE", rightSign, true);
+                        code.placeLabel(rightSignDone);
                     }
-                    else if (address == 1)
+                    if (leftNonNegative && rightNonNegative)
                     {
-                        address = getProcedureArgumentAddress(*variable->name);
-                        instructions.emplace_back("LOADI", address, true);
+                        unsignedOperations++;
                     }
-                    else if (address == 2)
+
+                    code.emit("SET", 0, true);
+                    code.emit("STORE", memoryPointer, true);
+                    long long quotientTemp = memoryPointer++;
+
+                    performDivision(leftValue, rightValue, quotientTemp);
+
+                    if (!leftNonNegative || !rightNonNegative)
                     {
-                        isInitialiazed(variable);
-                        address = getProcedureVariableAddress(*variable->name);
-                        instructions.emplace_back("LOAD", address, true);
+                        code.emit("LOAD", leftValue, true);
+                        code.emitJump("JZERO", remainderEnd);
                     }
-                    else if (it != iteratorMemoryMap.end())
+
+                    if (!leftNonNegative)
                     {
-                        long long address = getIteratorAddress(*variable->name);
-                        instructions.emplace_back("LOAD", address, true);
+                        long long leftPositive = code.newLabel();
+                        code.emit("LOAD", leftSign, true);
+                        code.emitJump("JPOS", leftPositive);
+                        code.emit("LOAD", rightValue, true);
+                        code.emit("SUB", leftValue, true);
+                        code.emit("STORE", leftValue, true);
+                        code.placeLabel(leftPositive);
                     }
-                    else
+
+                    if (!rightNonNegative)
                     {
-                        throw std::runtime_error("Undefined variable : " + *variable->name);
+                        long long rightPositive = code.newLabel();
+                        code.emit("LOAD", rightSign, true);
+                        code.emitJump("JPOS", rightPositive);
+                        code.emit("LOAD", leftValue, true);
+                        code.emit("SUB", rightValue, true);
+                        code.emit("STORE", leftValue, true);
+                        code.placeLabel(rightPositive);
                     }
+
+                    code.emit("LOAD", leftValue, true);
+                    code.placeLabel(remainderEnd);
+
+                    maxMemoryPointer = std::max(maxMemoryPointer, memoryPointer);
+
+                    memoryPointer -= 7;
                 }
-                else if (auto valueNode = dynamic_cast<ValueNode *>(expression))
-                {
-                    instructions.emplace_back("SET", valueNode->value, true);
-                }
-            }
-            else if (auto variable = dynamic_cast<IdentifierNode *>(expression))
-            {
-                auto it = iteratorMemoryMap.find(*variable->name);
-                if (variable->index)
-                {
-                    generateArrayAccess(variable);
-                    loadArrayValue(memoryPointer);
-                }
-                else if (it != iteratorMemoryMap.end())
-                {
-                    long long address = getIteratorAddress(*variable->name);
-                    instructions.emplace_back("LOAD", address, true);
-                }
-                else
-                {
-                    isInitialiazed(variable);
-                    long long address = getVariableMemoryAddress(*variable->name);
-                    instructions.emplace_back("LOAD", address, true);
-                }
+
+                releaseOperand(right);
+                releaseOperand(left);
             }
-            else if (auto valueNode = dynamic_cast<ValueNode *>(expression))
+            else
             {
-                instructions.emplace_back("SET", valueNode->value, true);
+                Operand operand = resolveOperand(expression);
+                loadOperand(operand);
+                releaseOperand(operand);
             }
         }
         catch (const std::runtime_error &e)
@@ -2526,9 +3750,11 @@ public:
             throw std::runtime_error("Invalid array range: start > end");
         }
         long long size = end - start + 1;
-        instructions.emplace_back("SET", memoryPointer - start, true);
+        arrayOffsets[name] = memoryPointer - start;
+        code.emit("SET", arrayOffsetCellValue(memoryPointer - start), true);
+        code.exposeRange(memoryPointer, memoryPointer + size - 1);
         memoryPointer += size;
-        instructions.emplace_back("STORE", memoryPointer, true);
+        code.emit("STORE", memoryPointer, true);
         arrayMemoryMap[name] = {memoryPointer, size};
         memoryPointer++;
     }
@@ -2544,6 +3770,16 @@ public:
         return it->second.first;
     }
 
+    long long getArrayOffset(const std::string &name) const
+    {
+        auto it = arrayOffsets.find(name);
+        if (it == arrayOffsets.end())
+        {
+            throw std::runtime_error("Undeclared array: " + name);
+        }
+        return it->second;
+    }
+
     long long getVariableMemoryAddress(const std::string &name) const
     {
         auto it = variableMemoryMap.find(name);
@@ -2554,6 +3790,39 @@ public:
         return it->second;
     }
 
+    void printStatistics(std::ostream &out) const
+    {
+        out << "accumulator tracking: " << code.getSkippedInstructions() << " redundant instructions skipped" << std::endl;
+        out << "inlining: " << inlinedCalls << " calls inlined, " << pendingClones.size() << " specialised clones, "
+            << preparedCallCount << " call setups moved to loop preheaders" << std::endl;
+        out << "partial evaluation: " << evaluatedCommands << " commands evaluated at compile time in " << evaluatedSteps
+            << " steps" << std::endl;
+        out << "value numbering: " << reusedValues << " expressions reused" << std::endl;
+        out << "instruction selection: " << retiledExpressions << " expressions given a cheaper tiling, array offsets "
+            << (negatedArrayOffsets ? "negated" : "kept positive") << std::endl;
+        out << "range analysis: " << unsignedOperations << " operations without sign handling, " << elidedGuards
+            << " zero tests elided" << std::endl;
+        out << "dead code: " << code.getRemovedBlocks() << " unreachable blocks removed, " << code.getRemovedStores()
+            << " dead stores removed" << std::endl;
+        out << "block layout: " << code.getMovedBlocks() << " blocks moved" << (profile ? " (profile-guided)" : "") << std::endl;
+        out << "constant pool: " << code.getPooledLoads() << " constant loads and " << code.getPooledLabels()
+            << " return addresses read from the pool" << std::endl;
+        out << "calling convention: " << copiedArgumentCount << " scalar arguments copied in and out, "
+            << aliasedProcedures.size() << " procedures called with aliased arguments" << std::endl;
+        out << "memory: " << std::max(memoryPointer, maxMemoryPointer) << " cells, " << sharedFrameCells
+            << " shared between procedure frames" << std::endl;
+        peephole.printStatistics(out);
+    }
+
+    void attributeProfile(Profile &executionProfile) const
+    {
+        if (static_cast<long long>(instructions.size()) != executionProfile.getProgramSize())
+        {
+            throw std::runtime_error("Profile was recorded for a different program");
+        }
+        code.attributeProfile(executionProfile);
+    }
+
     void printInstructions() const
     {
         for (const auto &instr : instructions)
@@ -0,0 +1,1122 @@
+#ifndef CONTROLFLOWGRAPH_HPP
+#define CONTROLFLOWGRAPH_HPP
+
+#include <iostream>
+#include <vector>
+#include <unordered_map>
+#include <set>
+#include <map>
+#include <string>
+#include <stdexcept>
+#include <algorithm>
+#include <cmath>
+
+#include "Profile.hpp"
+#include "labor4/maszyna_wirtualna/costs.hh"
+
+inline long long instructionCost(const std::string &op)
+{
+    static const std::unordered_map<std::string, long long> costs = []
+    {
+        std::unordered_map<std::string, long long> table;
+        for (int instruction = GET; instruction <= HALT; ++instruction)
+        {
+            table[instruction_name[instruction]] = instruction_cost[instruction];
+        }
+        return table;
+    }();
+    auto it = costs.find(op);
+    return it == costs.end() ? 0 : it->second;
+}
+
+class Instruction
+{
+public:
+    std::string operation;
+    long long argument;
+    bool hasArgument;
+
+    Instruction(const std::string &op, long long arg = 0, bool hasArg = false)
+        : operation(op), argument(arg), hasArgument(hasArg) {}
+
+    void print() const
+    {
+        if (hasArgument)
+        {
+            std::cout << operation << " " << argument << std::endl;
+        }
+        else
+        {
+            std::cout << operation << std::endl;
+        }
+    }
+};
+
+class IrInstruction
+{
+public:
+    std::string operation;
+    long long argument;
+    bool hasArgument;
+    long long target;
+
+    IrInstruction(const std::string &op, long long arg = 0, bool hasArg = false, long long label = -1)
+        : operation(op), argument(arg), hasArgument(hasArg), target(label) {}
+
+    bool isConditionalJump() const
+    {
+        return operation == "JPOS" || operation == "JZERO" || operation == "JNEG";
+    }
+
+    bool isTerminator() const
+    {
+        return isConditionalJump() || operation == "RTRN" || operation == "HALT";
+    }
+
+    bool isLabelAddress() const
+    {
+        return operation == "SET" && target != -1;
+    }
+};
+
+class BasicBlock
+{
+public:
+    long long label;
+    std::vector<IrInstruction> instructions;
+    long long next = -1;
+    long long depth = 0;
+    std::vector<BlockKey> keys;
+    std::vector<const void *> origins;
+    bool addressTaken = false;
+    std::vector<size_t> successors;
+    std::vector<size_t> predecessors;
+
+    explicit BasicBlock(long long blockLabel) : label(blockLabel) {}
+
+    const IrInstruction *terminator() const
+    {
+        if (instructions.empty() || !instructions.back().isTerminator())
+        {
+            return nullptr;
+        }
+        return &instructions.back();
+    }
+
+    long long branchTarget() const
+    {
+        auto last = terminator();
+        return last && last->isConditionalJump() ? last->target : -1;
+    }
+
+    bool returns() const
+    {
+        auto last = terminator();
+        return last && last->operation == "RTRN";
+    }
+};
+
+class AccumulatorState
+{
+private:
+    std::set<long long> cells;
+    bool hasConstant = false;
+    long long constant = 0;
+
+public:
+    void clear()
+    {
+        cells.clear();
+        hasConstant = false;
+    }
+
+    void meet(const AccumulatorState &other)
+    {
+        std::set<long long> common;
+        for (auto cell : cells)
+        {
+            if (other.cells.count(cell))
+            {
+                common.insert(cell);
+            }
+        }
+        cells = common;
+        hasConstant = hasConstant && other.hasConstant && constant == other.constant;
+    }
+
+    void knownZero()
+    {
+        hasConstant = true;
+        constant = 0;
+    }
+
+    bool operator==(const AccumulatorState &other) const
+    {
+        return cells == other.cells && hasConstant == other.hasConstant && (!hasConstant || constant == other.constant);
+    }
+
+    bool makesRedundant(const std::string &op, long long arg) const
+    {
+        if (op == "LOAD")
+        {
+            return arg == 0 || cells.count(arg);
+        }
+        if (op == "STORE")
+        {
+            return arg == 0 || cells.count(arg);
+        }
+        if (op == "SET")
+        {
+            return hasConstant && constant == arg;
+        }
+        return false;
+    }
+
+    void update(const std::string &op, long long arg)
+    {
+        if (op == "LOAD")
+        {
+            clear();
+            cells.insert(arg);
+        }
+        else if (op == "STORE")
+        {
+            cells.insert(arg);
+        }
+        else if (op == "SET")
+        {
+            clear();
+            hasConstant = true;
+            constant = arg;
+        }
+        else if (op == "SUB" && arg == 0)
+        {
+            clear();
+            hasConstant = true;
+            constant = 0;
+        }
+        else if (op == "GET")
+        {
+            if (arg == 0)
+            {
+                clear();
+            }
+            cells.erase(arg);
+        }
+        else if (op != "PUT" && op != "STOREI")
+        {
+            clear();
+        }
+    }
+};
+
+class ControlFlowGraph
+{
+private:
+    std::vector<BasicBlock> blocks;
+    long long labelCount = 0;
+    bool open = false;
+    bool pendingFallThrough = false;
+    AccumulatorState accumulator;
+    long long skippedInstructions = 0;
+    long long removedBlocks = 0;
+    long long removedStores = 0;
+    long long movedBlocks = 0;
+    long long pooledLoads = 0;
+    long long pooledLabels = 0;
+    long long loopDepth = 0;
+    std::vector<std::pair<const void *, long long>> originStack;
+    std::vector<const void *> pendingOrigins;
+    std::map<long long, long long> constantPool;
+    std::map<long long, long long> labelPool;
+    std::vector<std::pair<long long, long long>> indirectRanges;
+
+    static bool addressesMemory(const IrInstruction &instr)
+    {
+        return instr.hasArgument && instr.target == -1 && instr.operation != "SET" &&
+               instr.operation != "JUMP" && !instr.isConditionalJump();
+    }
+
+    BasicBlock &startBlock(long long label)
+    {
+        if (!blocks.empty() && (open || pendingFallThrough))
+        {
+            blocks.back().next = label;
+        }
+        blocks.emplace_back(label);
+        blocks.back().depth = loopDepth;
+        if (!originStack.empty())
+        {
+            blocks.back().keys.emplace_back(originStack.back().first, originStack.back().second++);
+        }
+        blocks.back().origins = std::move(pendingOrigins);
+        pendingOrigins.clear();
+        open = true;
+        pendingFallThrough = false;
+        return blocks.back();
+    }
+
+    BasicBlock &currentBlock()
+    {
+        if (!open)
+        {
+            startBlock(newLabel());
+        }
+        return blocks.back();
+    }
+
+    void close(bool fallsThrough)
+    {
+        open = false;
+        pendingFallThrough = fallsThrough;
+        if (!fallsThrough)
+        {
+            accumulator.clear();
+        }
+    }
+
+public:
+    long long newLabel()
+    {
+        return labelCount++;
+    }
+
+    void placeLabel(long long label)
+    {
+        startBlock(label);
+        accumulator.clear();
+    }
+
+    void enterLoop()
+    {
+        loopDepth++;
+        if (open)
+        {
+            blocks.back().depth = loopDepth;
+        }
+    }
+
+    void leaveLoop()
+    {
+        loopDepth--;
+    }
+
+    void enterOrigin(const void *origin)
+    {
+        originStack.emplace_back(origin, 0);
+        if (open)
+        {
+            blocks.back().origins.push_back(origin);
+        }
+        else
+        {
+            pendingOrigins.push_back(origin);
+        }
+    }
+
+    void leaveOrigin()
+    {
+        originStack.pop_back();
+    }
+
+    void emit(const std::string &op, long long arg = 0, bool hasArg = false)
+    {
+        if (op == "JUMP" || op == "JPOS" || op == "JZERO" || op == "JNEG")
+        {
+            throw std::runtime_error("Jumps must target a label: " + op);
+        }
+        if (accumulator.makesRedundant(op, arg))
+        {
+            skippedInstructions++;
+            return;
+        }
+        currentBlock().instructions.emplace_back(op, arg, hasArg);
+        accumulator.update(op, arg);
+        if (op == "RTRN" || op == "HALT")
+        {
+            close(false);
+        }
+    }
+
+    void emitJump(const std::string &op, long long label)
+    {
+        BasicBlock &block = currentBlock();
+        if (op == "JUMP")
+        {
+            block.next = label;
+            close(false);
+            return;
+        }
+        block.instructions.emplace_back(op, 0, true, label);
+        close(true);
+    }
+
+    void emitLabelAddress(long long label)
+    {
+        currentBlock().instructions.emplace_back("SET", 0, true, label);
+        accumulator.clear();
+    }
+
+    bool hasConstantCell(long long value) const
+    {
+        return constantPool.count(value) > 0;
+    }
+
+    long long getLoopDepth() const
+    {
+        return loopDepth;
+    }
+
+    long long constantCell(long long value)
+    {
+        auto it = constantPool.find(value);
+        if (it != constantPool.end())
+        {
+            return it->second;
+        }
+        long long placeholder = -static_cast<long long>(constantPool.size() + labelPool.size()) - 1;
+        constantPool[value] = placeholder;
+        return placeholder;
+    }
+
+    long long labelCell(long long label)
+    {
+        auto it = labelPool.find(label);
+        if (it != labelPool.end())
+        {
+            return it->second;
+        }
+        long long placeholder = -static_cast<long long>(constantPool.size() + labelPool.size()) - 1;
+        labelPool[label] = placeholder;
+        return placeholder;
+    }
+
+    long long highestAddress() const
+    {
+        long long highest = 0;
+        for (const auto &block : blocks)
+        {
+            for (const auto &instr : block.instructions)
+            {
+                if (addressesMemory(instr))
+                {
+                    highest = std::max(highest, instr.argument);
+                }
+            }
+        }
+        return highest;
+    }
+
+    void allocateConstants(long long firstAddress)
+    {
+        if (constantPool.empty() && labelPool.empty())
+        {
+            return;
+        }
+
+        std::unordered_map<long long, long long> addresses;
+        std::vector<IrInstruction> prologue;
+        long long address = firstAddress;
+        for (const auto &[value, placeholder] : constantPool)
+        {
+            addresses[placeholder] = address;
+            prologue.emplace_back("SET", value, true);
+            prologue.emplace_back("STORE", address, true);
+            address++;
+        }
+        for (const auto &[label, placeholder] : labelPool)
+        {
+            addresses[placeholder] = address;
+            prologue.emplace_back("SET", 0, true, label);
+            prologue.emplace_back("STORE", address, true);
+            address++;
+        }
+
+        for (auto &block : blocks)
+        {
+            for (auto &instr : block.instructions)
+            {
+                if (addressesMemory(instr) && instr.argument < 0)
+                {
+                    instr.argument = addresses.at(instr.argument);
+                }
+            }
+        }
+        auto &entry = blocks.front().instructions;
+        entry.insert(entry.begin(), prologue.begin(), prologue.end());
+    }
+
+    long long poolConstantLoads(const Profile *profile = nullptr)
+    {
+        auto frequency = [&](const BasicBlock &block)
+        {
+            if (profile)
+            {
+                auto counts = profiledCounts(block, *profile);
+                return counts ? static_cast<double>(counts->executed) : 0.0;
+            }
+            return std::pow(10.0, static_cast<double>(std::min(block.depth, 6LL)));
+        };
+
+        std::map<long long, double> executions;
+        std::map<long long, double> labelExecutions;
+        for (const auto &block : blocks)
+        {
+            for (const auto &instr : block.instructions)
+            {
+                if (instr.isLabelAddress())
+                {
+                    labelExecutions[instr.target] += frequency(block);
+                }
+                else if (instr.operation == "SET" && instr.argument != 0)
+                {
+                    executions[instr.argument] += frequency(block);
+                }
+            }
+        }
+
+        long long pooled = 0;
+        for (auto &block : blocks)
+        {
+            if (frequency(block) < 1.0)
+            {
+                continue;
+            }
+            for (auto &instr : block.instructions)
+            {
+                if (instr.isLabelAddress())
+                {
+                    double saved = (instructionCost("SET") - instructionCost("LOAD")) * labelExecutions[instr.target];
+                    if (saved > instructionCost("SET") + instructionCost("STORE"))
+                    {
+                        instr = IrInstruction("LOAD", labelCell(instr.target), true);
+                        pooledLabels++;
+                    }
+                    continue;
+                }
+                if (instr.operation != "SET" || instr.argument == 0)
+                {
+                    continue;
+                }
+                double saved = (instructionCost("SET") - instructionCost("LOAD")) * executions[instr.argument];
+                if (constantPool.count(instr.argument) || saved > instructionCost("SET") + instructionCost("STORE"))
+                {
+                    instr = IrInstruction("LOAD", constantCell(instr.argument), true);
+                    pooled++;
+                }
+            }
+        }
+        pooledLoads += pooled;
+        return pooled;
+    }
+
+    long long getPooledLoads() const
+    {
+        return pooledLoads;
+    }
+
+    long long getPooledLabels() const
+    {
+        return pooledLabels;
+    }
+
+    long long getSkippedInstructions() const
+    {
+        return skippedInstructions;
+    }
+
+    std::vector<BasicBlock> &getBlocks()
+    {
+        return blocks;
+    }
+
+    const std::vector<BasicBlock> &getBlocks() const
+    {
+        return blocks;
+    }
+
+    std::unordered_map<long long, size_t> blockIndices() const
+    {
+        std::unordered_map<long long, size_t> indices;
+        for (size_t i = 0; i < blocks.size(); ++i)
+        {
+            indices[blocks[i].label] = i;
+        }
+        return indices;
+    }
+
+    void buildEdges()
+    {
+        auto indices = blockIndices();
+        auto indexOf = [&](long long label)
+        {
+            auto it = indices.find(label);
+            if (it == indices.end())
+            {
+                throw std::runtime_error("Jump to undefined label " + std::to_string(label));
+            }
+            return it->second;
+        };
+
+        std::vector<size_t> returnPoints;
+        for (auto &block : blocks)
+        {
+            block.addressTaken = false;
+            block.successors.clear();
+            block.predecessors.clear();
+        }
+        for (const auto &block : blocks)
+        {
+            for (const auto &instr : block.instructions)
+            {
+                if (instr.isLabelAddress())
+                {
+                    blocks[indexOf(instr.target)].addressTaken = true;
+                }
+            }
+        }
+        for (size_t i = 0; i < blocks.size(); ++i)
+        {
+            if (blocks[i].addressTaken)
+            {
+                returnPoints.push_back(i);
+            }
+        }
+
+        for (size_t i = 0; i < blocks.size(); ++i)
+        {
+            auto &block = blocks[i];
+            if (block.returns())
+            {
+                block.successors = returnPoints;
+            }
+            if (block.branchTarget() != -1)
+            {
+                block.successors.push_back(indexOf(block.branchTarget()));
+            }
+            if (block.next != -1)
+            {
+                block.successors.push_back(indexOf(block.next));
+            }
+            for (auto successor : block.successors)
+            {
+                blocks[successor].predecessors.push_back(i);
+            }
+        }
+    }
+
+    long long removeRedundantInstructions()
+    {
+        buildEdges();
+        auto indices = blockIndices();
+        std::vector<AccumulatorState> entry(blocks.size());
+        std::vector<bool> reached(blocks.size(), false);
+        std::vector<size_t> worklist = {0};
+        reached[0] = true;
+
+        auto transfer = [&](size_t i, bool rewrite)
+        {
+            AccumulatorState state = entry[i];
+            long long removed = 0;
+            auto &code = blocks[i].instructions;
+            for (size_t j = 0; j < code.size();)
+            {
+                if (rewrite && code[j].target == -1 && state.makesRedundant(code[j].operation, code[j].argument))
+                {
+                    code.erase(code.begin() + j);
+                    removed++;
+                    continue;
+                }
+                if (code[j].isLabelAddress())
+                {
+                    state.clear();
+                }
+                else if (!code[j].isConditionalJump())
+                {
+                    state.update(code[j].operation, code[j].argument);
+                }
+                ++j;
+            }
+            return std::make_pair(state, removed);
+        };
+        auto propagate = [&](size_t successor, const AccumulatorState &state)
+        {
+            if (!reached[successor])
+            {
+                reached[successor] = true;
+                entry[successor] = state;
+                worklist.push_back(successor);
+                return;
+            }
+            AccumulatorState merged = entry[successor];
+            merged.meet(state);
+            if (!(merged == entry[successor]))
+            {
+                entry[successor] = merged;
+                worklist.push_back(successor);
+            }
+        };
+
+        while (!worklist.empty())
+        {
+            size_t i = worklist.back();
+            worklist.pop_back();
+            auto exit = transfer(i, false).first;
+            const auto &block = blocks[i];
+            if (block.returns())
+            {
+                for (auto successor : block.successors)
+                {
+                    propagate(successor, exit);
+                }
+            }
+            if (block.branchTarget() != -1)
+            {
+                AccumulatorState taken = exit;
+                if (block.terminator()->operation == "JZERO")
+                {
+                    taken.knownZero();
+                }
+                propagate(indices.at(block.branchTarget()), taken);
+            }
+            if (block.next != -1)
+            {
+                propagate(indices.at(block.next), exit);
+            }
+        }
+
+        long long removed = 0;
+        for (size_t i = 0; i < blocks.size(); ++i)
+        {
+            if (reached[i])
+            {
+                removed += transfer(i, true).second;
+            }
+        }
+        skippedInstructions += removed;
+        return removed;
+    }
+
+    long long removeUnreachableBlocks()
+    {
+        auto indices = blockIndices();
+        std::vector<bool> reached(blocks.size(), false);
+        std::vector<size_t> worklist = {0};
+        reached[0] = true;
+
+        auto visit = [&](long long label)
+        {
+            size_t i = indices.at(label);
+            if (!reached[i])
+            {
+                reached[i] = true;
+                worklist.push_back(i);
+            }
+        };
+
+        while (!worklist.empty())
+        {
+            const auto &block = blocks[worklist.back()];
+            worklist.pop_back();
+            for (const auto &instr : block.instructions)
+            {
+                if (instr.isLabelAddress() || instr.isConditionalJump())
+                {
+                    visit(instr.target);
+                }
+            }
+            if (block.next != -1)
+            {
+                visit(block.next);
+            }
+        }
+
+        long long removed = 0;
+        for (size_t i = blocks.size(); i-- > 1;)
+        {
+            if (!reached[i])
+            {
+                blocks.erase(blocks.begin() + i);
+                removed++;
+            }
+        }
+        removedBlocks += removed;
+        return removed;
+    }
+
+    long long removeDeadStores()
+    {
+        buildEdges();
+
+        std::set<long long> addressed;
+        for (const auto &block : blocks)
+        {
+            for (const auto &instr : block.instructions)
+            {
+                if (instr.operation == "SET" && instr.target == -1)
+                {
+                    addressed.insert(instr.argument);
+                }
+            }
+        }
+        auto reachableIndirectly = [&](long long cell)
+        {
+            for (const auto &[first, last] : indirectRanges)
+            {
+                if (first <= cell && cell <= last)
+                {
+                    return true;
+                }
+            }
+            return addressed.count(cell) > 0;
+        };
+
+        struct Liveness
+        {
+            std::set<long long> cells;
+            bool indirect = false;
+
+            bool merge(const Liveness &other)
+            {
+                size_t size = cells.size();
+                bool wasIndirect = indirect;
+                indirect = indirect || other.indirect;
+                cells.insert(other.cells.begin(), other.cells.end());
+                return cells.size() != size || indirect != wasIndirect;
+            }
+        };
+        auto live = [&](const Liveness &state, long long cell)
+        {
+            return cell == 0 || state.cells.count(cell) || (state.indirect && reachableIndirectly(cell));
+        };
+
+        auto transfer = [&](size_t i, Liveness state, bool rewrite)
+        {
+            long long removed = 0;
+            auto &code = blocks[i].instructions;
+            for (size_t j = code.size(); j-- > 0;)
+            {
+                const auto &instr = code[j];
+                if (instr.target != -1)
+                {
+                    continue;
+                }
+                const std::string &op = instr.operation;
+                if (op == "STORE" || op == "GET")
+                {
+                    if (op == "STORE" && rewrite && !live(state, instr.argument))
+                    {
+                        code.erase(code.begin() + j);
+                        removed++;
+                        continue;
+                    }
+                    state.cells.erase(instr.argument);
+                }
+                else if (op == "LOAD" || op == "ADD" || op == "SUB" || op == "PUT" || op == "RTRN")
+                {
+                    state.cells.insert(instr.argument);
+                }
+                else if (op == "LOADI" || op == "ADDI" || op == "SUBI")
+                {
+                    state.cells.insert(instr.argument);
+                    state.indirect = true;
+                }
+                else if (op == "STOREI")
+                {
+                    state.cells.insert(instr.argument);
+                }
+            }
+            return std::make_pair(state, removed);
+        };
+
+        std::vector<Liveness> liveOut(blocks.size());
+        std::vector<Liveness> liveIn(blocks.size());
+        bool changed = true;
+        while (changed)
+        {
+            changed = false;
+            for (size_t i = blocks.size(); i-- > 0;)
+            {
+                for (auto successor : blocks[i].successors)
+                {
+                    liveOut[i].merge(liveIn[successor]);
+                }
+                changed |= liveIn[i].merge(transfer(i, liveOut[i], false).first);
+            }
+        }
+
+        long long removed = 0;
+        for (size_t i = 0; i < blocks.size(); ++i)
+        {
+            removed += transfer(i, liveOut[i], true).second;
+        }
+        removedStores += removed;
+        return removed;
+    }
+
+    void exposeRange(long long first, long long last)
+    {
+        indirectRanges.emplace_back(first, last);
+    }
+
+    long long getRemovedBlocks() const
+    {
+        return removedBlocks;
+    }
+
+    long long getRemovedStores() const
+    {
+        return removedStores;
+    }
+
+    double takenProbability(size_t i, const std::unordered_map<long long, size_t> &indices) const
+    {
+        const auto &block = blocks[i];
+        long long target = block.branchTarget();
+        if (target == -1)
+        {
+            return 0.0;
+        }
+        if (indices.at(target) <= i)
+        {
+            return 0.9;
+        }
+        return block.terminator()->operation == "JZERO" ? 0.2 : 0.5;
+    }
+
+    std::vector<double> fallThroughWeights(const std::unordered_map<long long, size_t> &indices, const Profile *profile) const
+    {
+        if (profile)
+        {
+            std::vector<double> measured(blocks.size(), 0.0);
+            for (size_t i = 0; i < blocks.size(); ++i)
+            {
+                auto counts = profiledCounts(blocks[i], *profile);
+                if (counts && blocks[i].next != -1)
+                {
+                    measured[i] = static_cast<double>(counts->executed - counts->taken);
+                }
+            }
+            return measured;
+        }
+
+        std::vector<double> local(blocks.size(), 0.0);
+        std::vector<bool> entered(blocks.size(), false);
+        auto reach = [&](size_t from, long long label, double probability)
+        {
+            size_t to = indices.at(label);
+            if (to <= from)
+            {
+                return;
+            }
+            entered[to] = true;
+            local[to] += blocks[to].depth == blocks[from].depth ? local[from] * probability : 1.0;
+        };
+
+        std::vector<double> weights(blocks.size(), 0.0);
+        for (size_t i = 0; i < blocks.size(); ++i)
+        {
+            local[i] = entered[i] ? std::min(local[i], 1.0) : 1.0;
+            double taken = takenProbability(i, indices);
+            if (blocks[i].branchTarget() != -1)
+            {
+                reach(i, blocks[i].branchTarget(), taken);
+            }
+            if (blocks[i].next != -1)
+            {
+                reach(i, blocks[i].next, 1.0 - taken);
+                weights[i] = std::pow(10.0, static_cast<double>(std::min(blocks[i].depth, 6LL))) * local[i] * (1.0 - taken);
+            }
+        }
+        return weights;
+    }
+
+    long long layoutBlocks(const Profile *profile = nullptr)
+    {
+        auto indices = blockIndices();
+        std::vector<double> weights = fallThroughWeights(indices, profile);
+        std::vector<std::pair<double, size_t>> edges;
+        for (size_t i = 0; i < blocks.size(); ++i)
+        {
+            if (blocks[i].next != -1 && indices.at(blocks[i].next) != 0)
+            {
+                edges.emplace_back(weights[i], i);
+            }
+        }
+        std::stable_sort(edges.begin(), edges.end(), [&](const auto &a, const auto &b)
+                         {
+            if (a.first != b.first)
+            {
+                return a.first > b.first;
+            }
+            bool adjacentA = indices.at(blocks[a.second].next) == a.second + 1;
+            bool adjacentB = indices.at(blocks[b.second].next) == b.second + 1;
+            return adjacentA && !adjacentB; });
+
+        std::vector<long long> successor(blocks.size(), -1);
+        std::vector<long long> predecessor(blocks.size(), -1);
+        auto headOf = [&](size_t i)
+        {
+            while (predecessor[i] != -1)
+            {
+                i = predecessor[i];
+            }
+            return i;
+        };
+        for (const auto &[weight, from] : edges)
+        {
+            size_t to = indices.at(blocks[from].next);
+            if (successor[from] == -1 && predecessor[to] == -1 && headOf(from) != to)
+            {
+                successor[from] = to;
+                predecessor[to] = from;
+            }
+        }
+
+        std::vector<size_t> order;
+        for (size_t head = 0; head < blocks.size(); ++head)
+        {
+            if (predecessor[head] != -1)
+            {
+                continue;
+            }
+            for (long long i = head; i != -1; i = successor[i])
+            {
+                order.push_back(i);
+            }
+        }
+
+        auto jumpWeight = [&](const std::vector<size_t> &layout)
+        {
+            double total = 0.0;
+            for (size_t position = 0; position < layout.size(); ++position)
+            {
+                size_t i = layout[position];
+                if (blocks[i].next != -1 && (position + 1 == layout.size() || blocks[layout[position + 1]].label != blocks[i].next))
+                {
+                    total += weights[i];
+                }
+            }
+            return total;
+        };
+        std::vector<size_t> original(blocks.size());
+        for (size_t i = 0; i < blocks.size(); ++i)
+        {
+            original[i] = i;
+        }
+        if (jumpWeight(order) >= jumpWeight(original))
+        {
+            return 0;
+        }
+
+        long long moved = 0;
+        std::vector<BasicBlock> laidOut;
+        laidOut.reserve(blocks.size());
+        for (size_t position = 0; position < order.size(); ++position)
+        {
+            moved += order[position] != position;
+            laidOut.push_back(std::move(blocks[order[position]]));
+        }
+        blocks = std::move(laidOut);
+        movedBlocks += moved;
+        return moved;
+    }
+
+    long long getMovedBlocks() const
+    {
+        return movedBlocks;
+    }
+
+    bool needsJump(size_t i) const
+    {
+        return blocks[i].next != -1 && (i + 1 == blocks.size() || blocks[i + 1].label != blocks[i].next);
+    }
+
+    std::unordered_map<long long, long long> blockAddresses() const
+    {
+        std::unordered_map<long long, long long> addresses;
+        long long position = 0;
+        for (size_t i = 0; i < blocks.size(); ++i)
+        {
+            addresses[blocks[i].label] = position;
+            position += blocks[i].instructions.size() + (needsJump(i) ? 1 : 0);
+        }
+        return addresses;
+    }
+
+    static const BlockCounts *profiledCounts(const BasicBlock &block, const Profile &profile)
+    {
+        return block.keys.empty() ? nullptr : profile.block(block.keys.back());
+    }
+
+    void attributeProfile(Profile &profile) const
+    {
+        auto addresses = blockAddresses();
+        for (size_t i = 0; i < blocks.size(); ++i)
+        {
+            const auto &block = blocks[i];
+            if (block.instructions.empty() && !needsJump(i))
+            {
+                continue;
+            }
+            long long address = addresses.at(block.label);
+            BlockCounts counts(profile.instruction(address).executed, 0);
+            if (block.branchTarget() != -1)
+            {
+                counts.taken = profile.instruction(address + block.instructions.size() - 1).taken;
+            }
+            for (const auto &key : block.keys)
+            {
+                profile.recordBlock(key, key == block.keys.back() ? counts : BlockCounts(counts.executed, 0));
+            }
+            for (auto node : block.origins)
+            {
+                profile.recordNode(node, counts.executed);
+            }
+        }
+    }
+
+    std::vector<Instruction> assemble() const
+    {
+        auto addresses = blockAddresses();
+
+        auto addressOf = [&](long long label)
+        {
+            auto it = addresses.find(label);
+            if (it == addresses.end())
+            {
+                throw std::runtime_error("Jump to undefined label " + std::to_string(label));
+            }
+            return it->second;
+        };
+
+        std::vector<Instruction> program;
+        for (size_t i = 0; i < blocks.size(); ++i)
+        {
+            for (const auto &instr : blocks[i].instructions)
+            {
+                long long pc = program.size();
+                if (instr.isConditionalJump())
+                {
+                    program.emplace_back(instr.operation, addressOf(instr.target) - pc, true);
+                }
+                else if (instr.isLabelAddress())
+                {
+                    program.emplace_back(instr.operation, addressOf(instr.target), true);
+                }
+                else
+                {
+                    program.emplace_back(instr.operation, instr.argument, instr.hasArgument);
+                }
+            }
+            if (needsJump(i))
+            {
+                long long pc = program.size();
+                program.emplace_back("JUMP", addressOf(blocks[i].next) - pc, true);
+            }
+        }
+        return program;
+    }
+};
+
+#endif // CONTROLFLOWGRAPH_HPP
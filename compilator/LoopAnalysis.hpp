@@ -0,0 +1,550 @@
+#ifndef LOOPANALYSIS_HPP
+#define LOOPANALYSIS_HPP
+
+#include <functional>
+#include <map>
+#include <set>
+#include <string>
+
+#include "AstNode.hpp"
+
+class IteratorUsage
+{
+public:
+    std::map<std::string, long long> indexedArrays;
+    long long otherUses = 0;
+};
+
+class LoopWrites
+{
+public:
+    std::set<std::string> scalars;
+    std::set<std::string> arrays;
+};
+
+class LoopAnalysis
+{
+public:
+    static void forEachExpression(AstNode *node, const std::function<void(ExpressionNode *)> &visit)
+    {
+        if (!node)
+        {
+            return;
+        }
+
+        if (auto identifier = dynamic_cast<IdentifierNode *>(node))
+        {
+            visit(identifier);
+            forEachExpression(identifier->index, visit);
+        }
+        else if (auto binary = dynamic_cast<BinaryExpressionNode *>(node))
+        {
+            visit(binary);
+            forEachExpression(binary->left, visit);
+            forEachExpression(binary->right, visit);
+        }
+        else if (auto value = dynamic_cast<ValueNode *>(node))
+        {
+            visit(value);
+        }
+        else if (auto condition = dynamic_cast<ConditionNode *>(node))
+        {
+            forEachExpression(condition->leftValue, visit);
+            forEachExpression(condition->rightValue, visit);
+        }
+        else if (auto commands = dynamic_cast<CommandsNode *>(node))
+        {
+            for (auto command : commands->commands)
+            {
+                forEachExpression(command, visit);
+            }
+        }
+        else if (auto assign = dynamic_cast<AssignNode *>(node))
+        {
+            forEachExpression(assign->identifier, visit);
+            forEachExpression(assign->expression, visit);
+        }
+        else if (auto ifNode = dynamic_cast<IfNode *>(node))
+        {
+            forEachExpression(ifNode->condition, visit);
+            forEachExpression(ifNode->thenCommands, visit);
+            forEachExpression(ifNode->elseCommands, visit);
+        }
+        else if (auto whileNode = dynamic_cast<WhileNode *>(node))
+        {
+            forEachExpression(whileNode->condition, visit);
+            forEachExpression(whileNode->commands, visit);
+        }
+        else if (auto repeatNode = dynamic_cast<RepeatUntilNode *>(node))
+        {
+            forEachExpression(repeatNode->commands, visit);
+            forEachExpression(repeatNode->condition, visit);
+        }
+        else if (auto forNode = dynamic_cast<ForToNode *>(node))
+        {
+            forEachExpression(forNode->pidentifier, visit);
+            forEachExpression(forNode->fromValue, visit);
+            forEachExpression(forNode->toValue, visit);
+            forEachExpression(forNode->commands, visit);
+        }
+        else if (auto forNode = dynamic_cast<ForDownToNode *>(node))
+        {
+            forEachExpression(forNode->pidentifier, visit);
+            forEachExpression(forNode->fromValue, visit);
+            forEachExpression(forNode->toValue, visit);
+            forEachExpression(forNode->commands, visit);
+        }
+        else if (auto call = dynamic_cast<ProcedureCallNode *>(node))
+        {
+            if (call->arguments)
+            {
+                for (auto argument : call->arguments->arguments)
+                {
+                    forEachExpression(argument, visit);
+                }
+            }
+        }
+        else if (auto write = dynamic_cast<WriteNode *>(node))
+        {
+            forEachExpression(write->value, visit);
+        }
+        else if (auto read = dynamic_cast<ReadNode *>(node))
+        {
+            forEachExpression(read->identifier, visit);
+        }
+    }
+
+    static void forEachIdentifier(AstNode *node, const std::function<void(IdentifierNode *)> &visit)
+    {
+        forEachExpression(node, [&](ExpressionNode *expression)
+                          {
+            if (auto identifier = dynamic_cast<IdentifierNode *>(expression))
+            {
+                visit(identifier);
+            } });
+    }
+
+    static void collectWrites(AstNode *node, LoopWrites &writes)
+    {
+        if (!node)
+        {
+            return;
+        }
+
+        auto written = [&](IdentifierNode *identifier)
+        {
+            if (identifier->index)
+            {
+                writes.arrays.insert(*identifier->name);
+            }
+            else
+            {
+                writes.scalars.insert(*identifier->name);
+            }
+        };
+
+        if (auto commands = dynamic_cast<CommandsNode *>(node))
+        {
+            for (auto command : commands->commands)
+            {
+                collectWrites(command, writes);
+            }
+        }
+        else if (auto assign = dynamic_cast<AssignNode *>(node))
+        {
+            written(assign->identifier);
+        }
+        else if (auto read = dynamic_cast<ReadNode *>(node))
+        {
+            written(read->identifier);
+        }
+        else if (auto ifNode = dynamic_cast<IfNode *>(node))
+        {
+            collectWrites(ifNode->thenCommands, writes);
+            collectWrites(ifNode->elseCommands, writes);
+        }
+        else if (auto whileNode = dynamic_cast<WhileNode *>(node))
+        {
+            collectWrites(whileNode->commands, writes);
+        }
+        else if (auto repeatNode = dynamic_cast<RepeatUntilNode *>(node))
+        {
+            collectWrites(repeatNode->commands, writes);
+        }
+        else if (auto forNode = dynamic_cast<ForToNode *>(node))
+        {
+            writes.scalars.insert(*forNode->pidentifier->name);
+            collectWrites(forNode->commands, writes);
+        }
+        else if (auto forNode = dynamic_cast<ForDownToNode *>(node))
+        {
+            writes.scalars.insert(*forNode->pidentifier->name);
+            collectWrites(forNode->commands, writes);
+        }
+        else if (auto call = dynamic_cast<ProcedureCallNode *>(node))
+        {
+            if (call->arguments)
+            {
+                for (auto argument : call->arguments->arguments)
+                {
+                    if (auto identifier = dynamic_cast<IdentifierNode *>(argument))
+                    {
+                        writes.scalars.insert(*identifier->name);
+                        writes.arrays.insert(*identifier->name);
+                    }
+                }
+            }
+        }
+    }
+
+    static void collectEarlyReads(AstNode *node, std::set<std::string> &assigned, std::set<std::string> &early)
+    {
+        if (!node)
+        {
+            return;
+        }
+
+        auto reads = [&](AstNode *expression)
+        {
+            forEachIdentifier(expression, [&](IdentifierNode *identifier)
+                              {
+                if (!assigned.count(*identifier->name))
+                {
+                    early.insert(*identifier->name);
+                } });
+        };
+        auto target = [&](IdentifierNode *identifier)
+        {
+            if (identifier->index)
+            {
+                reads(identifier->index);
+            }
+            else
+            {
+                assigned.insert(*identifier->name);
+            }
+        };
+
+        if (auto commands = dynamic_cast<CommandsNode *>(node))
+        {
+            for (auto command : commands->commands)
+            {
+                collectEarlyReads(command, assigned, early);
+            }
+        }
+        else if (auto assign = dynamic_cast<AssignNode *>(node))
+        {
+            reads(assign->expression);
+            target(assign->identifier);
+        }
+        else if (auto read = dynamic_cast<ReadNode *>(node))
+        {
+            target(read->identifier);
+        }
+        else if (auto write = dynamic_cast<WriteNode *>(node))
+        {
+            reads(write->value);
+        }
+        else if (auto ifNode = dynamic_cast<IfNode *>(node))
+        {
+            reads(ifNode->condition);
+            auto thenAssigned = assigned;
+            auto elseAssigned = assigned;
+            collectEarlyReads(ifNode->thenCommands, thenAssigned, early);
+            collectEarlyReads(ifNode->elseCommands, elseAssigned, early);
+            for (const auto &name : thenAssigned)
+            {
+                if (elseAssigned.count(name))
+                {
+                    assigned.insert(name);
+                }
+            }
+        }
+        else if (auto whileNode = dynamic_cast<WhileNode *>(node))
+        {
+            reads(whileNode->condition);
+            auto bodyAssigned = assigned;
+            collectEarlyReads(whileNode->commands, bodyAssigned, early);
+        }
+        else if (auto repeatNode = dynamic_cast<RepeatUntilNode *>(node))
+        {
+            collectEarlyReads(repeatNode->commands, assigned, early);
+            reads(repeatNode->condition);
+        }
+        else if (auto forNode = dynamic_cast<ForToNode *>(node))
+        {
+            reads(forNode->fromValue);
+            reads(forNode->toValue);
+            auto bodyAssigned = assigned;
+            bodyAssigned.insert(*forNode->pidentifier->name);
+            collectEarlyReads(forNode->commands, bodyAssigned, early);
+        }
+        else if (auto forNode = dynamic_cast<ForDownToNode *>(node))
+        {
+            reads(forNode->fromValue);
+            reads(forNode->toValue);
+            auto bodyAssigned = assigned;
+            bodyAssigned.insert(*forNode->pidentifier->name);
+            collectEarlyReads(forNode->commands, bodyAssigned, early);
+        }
+        else if (auto call = dynamic_cast<ProcedureCallNode *>(node))
+        {
+            reads(call);
+        }
+    }
+
+    static bool keepsLocalsBetweenCalls(ProcedureNode *procedure)
+    {
+        if (!procedure->declarations)
+        {
+            return false;
+        }
+        std::set<std::string> assigned;
+        std::set<std::string> early;
+        collectEarlyReads(procedure->commands, assigned, early);
+        for (auto local : procedure->declarations->variables)
+        {
+            if (local->isArrayRange || early.count(*local->name))
+            {
+                return true;
+            }
+        }
+        return false;
+    }
+
+    static bool containsLoop(AstNode *node)
+    {
+        if (auto commands = dynamic_cast<CommandsNode *>(node))
+        {
+            for (auto command : commands->commands)
+            {
+                if (containsLoop(command))
+                {
+                    return true;
+                }
+            }
+            return false;
+        }
+        if (auto ifNode = dynamic_cast<IfNode *>(node))
+        {
+            return containsLoop(ifNode->thenCommands) || containsLoop(ifNode->elseCommands);
+        }
+        return dynamic_cast<WhileNode *>(node) || dynamic_cast<RepeatUntilNode *>(node) ||
+               dynamic_cast<ForToNode *>(node) || dynamic_cast<ForDownToNode *>(node);
+    }
+
+    static void collectIterators(AstNode *node, std::set<std::string> &iterators)
+    {
+        if (auto commands = dynamic_cast<CommandsNode *>(node))
+        {
+            for (auto command : commands->commands)
+            {
+                collectIterators(command, iterators);
+            }
+        }
+        else if (auto ifNode = dynamic_cast<IfNode *>(node))
+        {
+            collectIterators(ifNode->thenCommands, iterators);
+            collectIterators(ifNode->elseCommands, iterators);
+        }
+        else if (auto whileNode = dynamic_cast<WhileNode *>(node))
+        {
+            collectIterators(whileNode->commands, iterators);
+        }
+        else if (auto repeatNode = dynamic_cast<RepeatUntilNode *>(node))
+        {
+            collectIterators(repeatNode->commands, iterators);
+        }
+        else if (auto forNode = dynamic_cast<ForToNode *>(node))
+        {
+            iterators.insert(*forNode->pidentifier->name);
+            collectIterators(forNode->commands, iterators);
+        }
+        else if (auto forNode = dynamic_cast<ForDownToNode *>(node))
+        {
+            iterators.insert(*forNode->pidentifier->name);
+            collectIterators(forNode->commands, iterators);
+        }
+    }
+
+    static void forEachCall(AstNode *node, const std::function<void(ProcedureCallNode *, bool)> &visit, bool inLoop = false)
+    {
+        if (auto commands = dynamic_cast<CommandsNode *>(node))
+        {
+            for (auto command : commands->commands)
+            {
+                forEachCall(command, visit, inLoop);
+            }
+        }
+        else if (auto ifNode = dynamic_cast<IfNode *>(node))
+        {
+            forEachCall(ifNode->thenCommands, visit, inLoop);
+            forEachCall(ifNode->elseCommands, visit, inLoop);
+        }
+        else if (auto whileNode = dynamic_cast<WhileNode *>(node))
+        {
+            forEachCall(whileNode->commands, visit, true);
+        }
+        else if (auto repeatNode = dynamic_cast<RepeatUntilNode *>(node))
+        {
+            forEachCall(repeatNode->commands, visit, true);
+        }
+        else if (auto forNode = dynamic_cast<ForToNode *>(node))
+        {
+            forEachCall(forNode->commands, visit, true);
+        }
+        else if (auto forNode = dynamic_cast<ForDownToNode *>(node))
+        {
+            forEachCall(forNode->commands, visit, true);
+        }
+        else if (auto call = dynamic_cast<ProcedureCallNode *>(node))
+        {
+            visit(call, inLoop);
+        }
+    }
+
+    static void forEachLoop(AstNode *node, const std::function<void(CommandsNode *)> &visit)
+    {
+        if (auto commands = dynamic_cast<CommandsNode *>(node))
+        {
+            for (auto command : commands->commands)
+            {
+                forEachLoop(command, visit);
+            }
+        }
+        else if (auto ifNode = dynamic_cast<IfNode *>(node))
+        {
+            forEachLoop(ifNode->thenCommands, visit);
+            forEachLoop(ifNode->elseCommands, visit);
+        }
+        else if (auto whileNode = dynamic_cast<WhileNode *>(node))
+        {
+            visit(whileNode->commands);
+            forEachLoop(whileNode->commands, visit);
+        }
+        else if (auto repeatNode = dynamic_cast<RepeatUntilNode *>(node))
+        {
+            visit(repeatNode->commands);
+            forEachLoop(repeatNode->commands, visit);
+        }
+        else if (auto forNode = dynamic_cast<ForToNode *>(node))
+        {
+            visit(forNode->commands);
+            forEachLoop(forNode->commands, visit);
+        }
+        else if (auto forNode = dynamic_cast<ForDownToNode *>(node))
+        {
+            visit(forNode->commands);
+            forEachLoop(forNode->commands, visit);
+        }
+    }
+
+    static void collectCallsOutsideFor(AstNode *node, std::vector<ProcedureCallNode *> &calls)
+    {
+        if (auto commands = dynamic_cast<CommandsNode *>(node))
+        {
+            for (auto command : commands->commands)
+            {
+                collectCallsOutsideFor(command, calls);
+            }
+        }
+        else if (auto ifNode = dynamic_cast<IfNode *>(node))
+        {
+            collectCallsOutsideFor(ifNode->thenCommands, calls);
+            collectCallsOutsideFor(ifNode->elseCommands, calls);
+        }
+        else if (auto whileNode = dynamic_cast<WhileNode *>(node))
+        {
+            collectCallsOutsideFor(whileNode->commands, calls);
+        }
+        else if (auto repeatNode = dynamic_cast<RepeatUntilNode *>(node))
+        {
+            collectCallsOutsideFor(repeatNode->commands, calls);
+        }
+        else if (auto call = dynamic_cast<ProcedureCallNode *>(node))
+        {
+            calls.push_back(call);
+        }
+    }
+
+    static bool passesToCall(AstNode *node, const std::string &name)
+    {
+        if (auto commands = dynamic_cast<CommandsNode *>(node))
+        {
+            for (auto command : commands->commands)
+            {
+                if (passesToCall(command, name))
+                {
+                    return true;
+                }
+            }
+        }
+        else if (auto ifNode = dynamic_cast<IfNode *>(node))
+        {
+            return passesToCall(ifNode->thenCommands, name) || passesToCall(ifNode->elseCommands, name);
+        }
+        else if (auto call = dynamic_cast<ProcedureCallNode *>(node))
+        {
+            if (call->arguments)
+            {
+                for (auto argument : call->arguments->arguments)
+                {
+                    auto identifier = dynamic_cast<IdentifierNode *>(argument);
+                    if (identifier && *identifier->name == name)
+                    {
+                        return true;
+                    }
+                }
+            }
+        }
+        return false;
+    }
+
+    static long long estimateSize(AstNode *node, const std::map<std::string, long long> &calleeSizes = {})
+    {
+        long long size = 0;
+        forEachCall(node, [&](ProcedureCallNode *call, bool)
+                    {
+            auto callee = calleeSizes.find(*call->procedureName);
+            if (callee != calleeSizes.end())
+            {
+                size += callee->second;
+            } });
+        forEachExpression(node, [&](ExpressionNode *expression)
+                          {
+            if (auto binary = dynamic_cast<BinaryExpressionNode *>(expression))
+            {
+                size += binary->operation == "+" || binary->operation == "-" ? 1 : 40;
+            }
+            else if (auto identifier = dynamic_cast<IdentifierNode *>(expression))
+            {
+                size += identifier->index ? 4 : 2;
+            }
+            else
+            {
+                size += 1;
+            } });
+        return size;
+    }
+
+    static IteratorUsage analyzeIterator(CommandsNode *body, const std::string &iterator)
+    {
+        IteratorUsage usage;
+        std::set<IdentifierNode *> indices;
+        forEachIdentifier(body, [&](IdentifierNode *identifier)
+                          {
+            auto index = dynamic_cast<IdentifierNode *>(identifier->index);
+            if (index && !index->index && *index->name == iterator)
+            {
+                usage.indexedArrays[*identifier->name]++;
+                indices.insert(index);
+            }
+            else if (*identifier->name == iterator && !indices.count(identifier))
+            {
+                usage.otherUses++;
+            } });
+        return usage;
+    }
+};
+
+#endif // LOOPANALYSIS_HPP
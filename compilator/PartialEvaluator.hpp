@@ -0,0 +1,515 @@
+#ifndef PARTIALEVALUATOR_HPP
+#define PARTIALEVALUATOR_HPP
+
+#include <climits>
+#include <iterator>
+#include <map>
+#include <set>
+#include <string>
+#include <vector>
+
+#include "AstNode.hpp"
+#include "LoopAnalysis.hpp"
+
+class EvaluationStopped
+{
+};
+
+class EvaluatedPrefix
+{
+public:
+    size_t commands = 0;
+    long long steps = 0;
+    std::vector<long long> outputs;
+    std::map<std::string, long long> scalars;
+    std::map<std::string, std::map<long long, long long>> arrays;
+    std::set<std::string> initialized;
+};
+
+class PartialEvaluator
+{
+private:
+    struct Array
+    {
+        long long low;
+        long long high;
+        long long base;
+    };
+
+    struct Scope
+    {
+        size_t procedure;
+        std::map<std::string, long long> scalars;
+        std::map<std::string, Array> arrays;
+        std::map<std::string, long long> iterators;
+    };
+
+    std::vector<ProcedureNode *> procedures;
+    std::map<std::string, size_t> procedureIndices;
+    std::map<long long, long long> memory;
+    std::vector<long long> outputs;
+    long long nextCell = 0;
+    long long fuel;
+    long long maxCells;
+
+    void spend()
+    {
+        if (fuel-- <= 0)
+        {
+            throw EvaluationStopped();
+        }
+    }
+
+    static long long checked(__int128 value)
+    {
+        if (value < LLONG_MIN || value > LLONG_MAX)
+        {
+            throw EvaluationStopped();
+        }
+        return static_cast<long long>(value);
+    }
+
+    void declare(Scope &scope, DeclarationsNode *declarations)
+    {
+        if (!declarations)
+        {
+            return;
+        }
+        for (auto variable : declarations->variables)
+        {
+            const std::string &name = *variable->name;
+            if (scope.scalars.count(name) || scope.arrays.count(name))
+            {
+                throw EvaluationStopped();
+            }
+            if (variable->isArrayRange)
+            {
+                if (variable->start > variable->end)
+                {
+                    throw EvaluationStopped();
+                }
+                scope.arrays[name] = {variable->start, variable->end, nextCell};
+                nextCell += variable->end - variable->start + 1;
+            }
+            else
+            {
+                scope.scalars[name] = nextCell++;
+            }
+        }
+    }
+
+    long long cellOf(IdentifierNode *identifier, Scope &scope)
+    {
+        const std::string &name = *identifier->name;
+        if (!identifier->index)
+        {
+            auto iterator = scope.iterators.find(name);
+            if (iterator != scope.iterators.end())
+            {
+                return iterator->second;
+            }
+            auto scalar = scope.scalars.find(name);
+            if (scalar == scope.scalars.end())
+            {
+                throw EvaluationStopped();
+            }
+            return scalar->second;
+        }
+
+        auto array = scope.arrays.find(name);
+        if (array == scope.arrays.end())
+        {
+            throw EvaluationStopped();
+        }
+        long long index = valueOf(identifier->index, scope);
+        if (index < array->second.low || index > array->second.high)
+        {
+            throw EvaluationStopped();
+        }
+        return array->second.base + index - array->second.low;
+    }
+
+    long long valueOf(ExpressionNode *expression, Scope &scope)
+    {
+        if (auto value = dynamic_cast<ValueNode *>(expression))
+        {
+            return value->value;
+        }
+        auto identifier = dynamic_cast<IdentifierNode *>(expression);
+        if (!identifier)
+        {
+            throw EvaluationStopped();
+        }
+        auto cell = memory.find(cellOf(identifier, scope));
+        if (cell == memory.end())
+        {
+            throw EvaluationStopped();
+        }
+        return cell->second;
+    }
+
+    long long evaluate(ExpressionNode *expression, Scope &scope)
+    {
+        spend();
+        auto binary = dynamic_cast<BinaryExpressionNode *>(expression);
+        if (!binary)
+        {
+            return valueOf(expression, scope);
+        }
+
+        __int128 left = valueOf(binary->left, scope);
+        __int128 right = valueOf(binary->right, scope);
+        if (binary->operation == "+")
+        {
+            return checked(left + right);
+        }
+        if (binary->operation == "-")
+        {
+            return checked(left - right);
+        }
+        if (binary->operation == "*")
+        {
+            return checked(left * right);
+        }
+        if (right == 0)
+        {
+            return 0;
+        }
+        if (binary->operation == "/")
+        {
+            return checked(left / right);
+        }
+        __int128 remainder = left % right;
+        if (remainder != 0 && (remainder < 0) != (right < 0))
+        {
+            remainder += right;
+        }
+        return checked(remainder);
+    }
+
+    bool holds(ConditionNode *condition, Scope &scope)
+    {
+        spend();
+        long long left = valueOf(condition->leftValue, scope);
+        long long right = valueOf(condition->rightValue, scope);
+        const std::string &operation = condition->operation;
+        if (operation == "=")
+        {
+            return left == right;
+        }
+        if (operation == "!=")
+        {
+            return left != right;
+        }
+        if (operation == "<")
+        {
+            return left < right;
+        }
+        if (operation == ">")
+        {
+            return left > right;
+        }
+        if (operation == "<=")
+        {
+            return left <= right;
+        }
+        return left >= right;
+    }
+
+    void assign(IdentifierNode *target, long long value, Scope &scope)
+    {
+        if (!target->index && scope.iterators.count(*target->name))
+        {
+            throw EvaluationStopped();
+        }
+        memory[cellOf(target, scope)] = value;
+    }
+
+    void execute(CommandsNode *commands, Scope &scope)
+    {
+        if (!commands)
+        {
+            return;
+        }
+        for (auto command : commands->commands)
+        {
+            execute(command, scope);
+        }
+    }
+
+    void executeFor(IdentifierNode *iterator, ExpressionNode *from, ExpressionNode *to, CommandsNode *body, long long step, Scope &scope)
+    {
+        const std::string &name = *iterator->name;
+        if (scope.iterators.count(name))
+        {
+            throw EvaluationStopped();
+        }
+        long long first = valueOf(from, scope);
+        long long last = valueOf(to, scope);
+        long long cell = nextCell++;
+        scope.iterators[name] = cell;
+        for (long long value = first; step > 0 ? value <= last : value >= last; value += step)
+        {
+            spend();
+            memory[cell] = value;
+            execute(body, scope);
+            if (value == last)
+            {
+                break;
+            }
+        }
+        scope.iterators.erase(name);
+        memory.erase(cell);
+    }
+
+    void call(ProcedureCallNode *callNode, Scope &scope)
+    {
+        auto found = procedureIndices.find(*callNode->procedureName);
+        if (found == procedureIndices.end() || found->second >= scope.procedure || !callNode->arguments)
+        {
+            throw EvaluationStopped();
+        }
+        ProcedureNode *procedure = procedures[found->second];
+        if (LoopAnalysis::keepsLocalsBetweenCalls(procedure))
+        {
+            throw EvaluationStopped();
+        }
+        auto &formals = procedure->arguments->argumentsDeclaration->args;
+        auto &actuals = callNode->arguments->arguments;
+        if (formals.size() != actuals.size())
+        {
+            throw EvaluationStopped();
+        }
+
+        Scope callee{found->second, {}, {}, {}};
+        long long firstLocal = nextCell;
+        for (size_t i = 0; i < formals.size(); ++i)
+        {
+            const std::string &formal = *formals[i]->argumentName;
+            const std::string &actual = *dynamic_cast<IdentifierNode *>(actuals[i])->name;
+            if (callee.scalars.count(formal) || callee.arrays.count(formal) || scope.iterators.count(actual))
+            {
+                throw EvaluationStopped();
+            }
+            if (formals[i]->isArray)
+            {
+                auto array = scope.arrays.find(actual);
+                if (array == scope.arrays.end())
+                {
+                    throw EvaluationStopped();
+                }
+                callee.arrays[formal] = array->second;
+            }
+            else
+            {
+                auto scalar = scope.scalars.find(actual);
+                if (scalar == scope.scalars.end())
+                {
+                    throw EvaluationStopped();
+                }
+                callee.scalars[formal] = scalar->second;
+            }
+        }
+        declare(callee, procedure->declarations);
+        execute(procedure->commands, callee);
+        memory.erase(memory.lower_bound(firstLocal), memory.end());
+    }
+
+    void execute(CommandNode *command, Scope &scope)
+    {
+        spend();
+        if (auto assignNode = dynamic_cast<AssignNode *>(command))
+        {
+            assign(assignNode->identifier, evaluate(assignNode->expression, scope), scope);
+        }
+        else if (auto writeNode = dynamic_cast<WriteNode *>(command))
+        {
+            outputs.push_back(valueOf(writeNode->value, scope));
+        }
+        else if (auto ifNode = dynamic_cast<IfNode *>(command))
+        {
+            execute(holds(ifNode->condition, scope) ? ifNode->thenCommands : ifNode->elseCommands, scope);
+        }
+        else if (auto whileNode = dynamic_cast<WhileNode *>(command))
+        {
+            while (holds(whileNode->condition, scope))
+            {
+                execute(whileNode->commands, scope);
+            }
+        }
+        else if (auto repeatNode = dynamic_cast<RepeatUntilNode *>(command))
+        {
+            do
+            {
+                execute(repeatNode->commands, scope);
+            } while (!holds(repeatNode->condition, scope));
+        }
+        else if (auto forToNode = dynamic_cast<ForToNode *>(command))
+        {
+            executeFor(forToNode->pidentifier, forToNode->fromValue, forToNode->toValue, forToNode->commands, 1, scope);
+        }
+        else if (auto forDownToNode = dynamic_cast<ForDownToNode *>(command))
+        {
+            executeFor(forDownToNode->pidentifier, forDownToNode->fromValue, forDownToNode->toValue, forDownToNode->commands, -1, scope);
+        }
+        else if (auto callNode = dynamic_cast<ProcedureCallNode *>(command))
+        {
+            call(callNode, scope);
+        }
+        else
+        {
+            throw EvaluationStopped();
+        }
+    }
+
+    static void collectInitialized(CommandsNode *commands, std::set<std::string> &names)
+    {
+        if (!commands)
+        {
+            return;
+        }
+        for (auto command : commands->commands)
+        {
+            collectInitialized(command, names);
+        }
+    }
+
+    static void collectInitialized(CommandNode *command, std::set<std::string> &names)
+    {
+        if (auto assignNode = dynamic_cast<AssignNode *>(command))
+        {
+            if (!assignNode->identifier->index)
+            {
+                names.insert(*assignNode->identifier->name);
+            }
+        }
+        else if (auto callNode = dynamic_cast<ProcedureCallNode *>(command))
+        {
+            for (auto argument : callNode->arguments ? callNode->arguments->arguments : std::vector<ExpressionNode *>())
+            {
+                names.insert(*dynamic_cast<IdentifierNode *>(argument)->name);
+            }
+        }
+        else if (auto ifNode = dynamic_cast<IfNode *>(command))
+        {
+            collectInitialized(ifNode->thenCommands, names);
+            collectInitialized(ifNode->elseCommands, names);
+        }
+        else if (auto whileNode = dynamic_cast<WhileNode *>(command))
+        {
+            collectInitialized(whileNode->commands, names);
+        }
+        else if (auto repeatNode = dynamic_cast<RepeatUntilNode *>(command))
+        {
+            collectInitialized(repeatNode->commands, names);
+        }
+        else if (auto forToNode = dynamic_cast<ForToNode *>(command))
+        {
+            collectInitialized(forToNode->commands, names);
+        }
+        else if (auto forDownToNode = dynamic_cast<ForDownToNode *>(command))
+        {
+            collectInitialized(forDownToNode->commands, names);
+        }
+    }
+
+    long long mainCells(const Scope &scope) const
+    {
+        long long cells = 0;
+        for (const auto &[name, cell] : scope.scalars)
+        {
+            cells += memory.count(cell);
+        }
+        for (const auto &[name, array] : scope.arrays)
+        {
+            cells += std::distance(memory.lower_bound(array.base), memory.lower_bound(array.base + array.high - array.low + 1));
+        }
+        return cells;
+    }
+
+public:
+    PartialEvaluator(ProceduresNode *proceduresNode, long long fuelLimit, long long cellLimit)
+        : fuel(fuelLimit), maxCells(cellLimit)
+    {
+        if (!proceduresNode)
+        {
+            return;
+        }
+        for (auto procedure : proceduresNode->procedures)
+        {
+            if (!procedure->arguments || !procedure->arguments->argumentsDeclaration ||
+                !procedureIndices.emplace(*procedure->arguments->procedureName, procedures.size()).second)
+            {
+                procedures.clear();
+                procedureIndices.clear();
+                return;
+            }
+            procedures.push_back(procedure);
+        }
+    }
+
+    EvaluatedPrefix run(MainNode *mainNode)
+    {
+        EvaluatedPrefix prefix;
+        if (!mainNode->commands)
+        {
+            return prefix;
+        }
+
+        Scope scope{procedures.size(), {}, {}, {}};
+        long long initialFuel = fuel;
+        try
+        {
+            declare(scope, mainNode->declarations);
+        }
+        catch (const EvaluationStopped &)
+        {
+            return prefix;
+        }
+
+        for (auto command : mainNode->commands->commands)
+        {
+            auto savedMemory = memory;
+            size_t savedOutputs = outputs.size();
+            long long savedFuel = fuel;
+            try
+            {
+                execute(command, scope);
+                if (mainCells(scope) > maxCells)
+                {
+                    throw EvaluationStopped();
+                }
+            }
+            catch (const EvaluationStopped &)
+            {
+                memory = std::move(savedMemory);
+                outputs.resize(savedOutputs);
+                fuel = savedFuel;
+                break;
+            }
+            collectInitialized(command, prefix.initialized);
+            prefix.commands++;
+        }
+
+        prefix.steps = initialFuel - fuel;
+        prefix.outputs = outputs;
+        for (const auto &[name, cell] : scope.scalars)
+        {
+            auto value = memory.find(cell);
+            if (value != memory.end())
+            {
+                prefix.scalars[name] = value->second;
+            }
+        }
+        for (const auto &[name, array] : scope.arrays)
+        {
+            for (auto it = memory.lower_bound(array.base); it != memory.end() && it->first <= array.base + array.high - array.low; ++it)
+            {
+                prefix.arrays[name][array.low + it->first - array.base] = it->second;
+            }
+        }
+        return prefix;
+    }
+};
+
+#endif // PARTIALEVALUATOR_HPP
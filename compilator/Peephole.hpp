@@ -0,0 +1,378 @@
+#ifndef PEEPHOLE_HPP
+#define PEEPHOLE_HPP
+
+#include <iostream>
+#include <vector>
+#include <map>
+#include <set>
+#include <algorithm>
+#include <string>
+#include <functional>
+#include <memory>
+
+#include "ControlFlowGraph.hpp"
+#include "Superoptimizer.hpp"
+
+class PeepholeRule
+{
+public:
+    std::string name;
+    size_t window;
+    std::function<bool(const std::vector<IrInstruction> &, size_t)> matches;
+    std::function<std::vector<IrInstruction>(const std::vector<IrInstruction> &, size_t)> rewrite;
+
+    PeepholeRule(const std::string &ruleName, size_t size,
+                 std::function<bool(const std::vector<IrInstruction> &, size_t)> matcher,
+                 std::function<std::vector<IrInstruction>(const std::vector<IrInstruction> &, size_t)> rewriter)
+        : name(ruleName), window(size), matches(matcher), rewrite(rewriter) {}
+};
+
+class PeepholeOptimizer
+{
+private:
+    std::vector<PeepholeRule> rules;
+    std::shared_ptr<Superoptimizer> superoptimizer = std::make_shared<Superoptimizer>();
+    std::map<std::string, long long> hits;
+    long long instructionsBefore = 0;
+    long long instructionsAfter = 0;
+    long long costBefore = 0;
+    long long costAfter = 0;
+    std::set<long long> changedBlocks;
+
+    static bool is(const IrInstruction &instr, const std::string &op)
+    {
+        return instr.operation == op && instr.target == -1;
+    }
+
+    static bool same(const IrInstruction &a, const std::string &opA, const IrInstruction &b, const std::string &opB)
+    {
+        return is(a, opA) && is(b, opB) && a.argument == b.argument;
+    }
+
+    static bool overwritesAccumulatorOnly(const IrInstruction &instr)
+    {
+        static const std::vector<std::string> pure = {"LOAD", "LOADI", "SET", "ADD", "SUB", "ADDI", "SUBI", "HALF"};
+        for (const auto &op : pure)
+        {
+            if (is(instr, op))
+            {
+                return true;
+            }
+        }
+        return false;
+    }
+
+    static bool ignoresAccumulator(const IrInstruction &instr)
+    {
+        return is(instr, "SET") || (is(instr, "LOAD") && instr.argument != 0);
+    }
+
+    static std::vector<PeepholeRule> defaultRules()
+    {
+        using Code = std::vector<IrInstruction>;
+        return {
+            PeepholeRule("store-load", 2,
+                         [](const Code &c, size_t i)
+                         { return same(c[i], "STORE", c[i + 1], "LOAD"); },
+                         [](const Code &c, size_t i)
+                         { return Code{c[i]}; }),
+            PeepholeRule("load-store", 2,
+                         [](const Code &c, size_t i)
+                         { return same(c[i], "LOAD", c[i + 1], "STORE"); },
+                         [](const Code &c, size_t i)
+                         { return Code{c[i]}; }),
+            PeepholeRule("store-store", 2,
+                         [](const Code &c, size_t i)
+                         { return same(c[i], "STORE", c[i + 1], "STORE"); },
+                         [](const Code &c, size_t i)
+                         { return Code{c[i]}; }),
+            PeepholeRule("dead-accumulator", 2,
+                         [](const Code &c, size_t i)
+                         { return overwritesAccumulatorOnly(c[i]) && ignoresAccumulator(c[i + 1]); },
+                         [](const Code &c, size_t i)
+                         { return Code{c[i + 1]}; }),
+            PeepholeRule("load-sub-self", 2,
+                         [](const Code &c, size_t i)
+                         { return same(c[i], "LOAD", c[i + 1], "SUB") && c[i].argument != 0; },
+                         [](const Code &, size_t)
+                         { return Code{IrInstruction("SUB", 0, true)}; }),
+            PeepholeRule("zero-add", 2,
+                         [](const Code &c, size_t i)
+                         { return is(c[i], "SUB") && c[i].argument == 0 && is(c[i + 1], "ADD") && c[i + 1].argument != 0; },
+                         [](const Code &c, size_t i)
+                         { return Code{IrInstruction("LOAD", c[i + 1].argument, true)}; }),
+            PeepholeRule("set-zero", 1,
+                         [](const Code &c, size_t i)
+                         { return is(c[i], "SET") && c[i].argument == 0; },
+                         [](const Code &, size_t)
+                         { return Code{IrInstruction("SUB", 0, true)}; }),
+        };
+    }
+
+    std::vector<PeepholeRule> superoptimizedRules() const
+    {
+        using Code = std::vector<IrInstruction>;
+        std::vector<PeepholeRule> learned;
+        auto search = superoptimizer;
+        for (size_t window = search->getMaxWindow(); window >= 2; --window)
+        {
+            learned.emplace_back("superoptimized", window,
+                                 [search, window](const Code &c, size_t i)
+                                 { return search->matches(c, i, window); },
+                                 [search, window](const Code &c, size_t i)
+                                 { return search->rewrite(c, i, window); });
+        }
+        return learned;
+    }
+
+    void learnHotSequences(ControlFlowGraph &code)
+    {
+        auto &blocks = code.getBlocks();
+        auto indices = code.blockIndices();
+        for (size_t i = 0; i < blocks.size(); ++i)
+        {
+            auto closesLoop = [&](long long label)
+            {
+                return label != -1 && indices.count(label) && indices.at(label) <= i;
+            };
+            if (!changedBlocks.count(blocks[i].label))
+            {
+                continue;
+            }
+            if (blocks[i].depth > 0 || closesLoop(blocks[i].branchTarget()) || closesLoop(blocks[i].next))
+            {
+                superoptimizer->learn(blocks[i].instructions);
+            }
+        }
+    }
+
+    bool applyRules(BasicBlock &block)
+    {
+        bool changed = false;
+        auto &code = block.instructions;
+        for (size_t i = 0; i < code.size(); ++i)
+        {
+            for (const auto &rule : rules)
+            {
+                if (i + rule.window > code.size() || !rule.matches(code, i))
+                {
+                    continue;
+                }
+                auto replacement = rule.rewrite(code, i);
+                code.erase(code.begin() + i, code.begin() + i + rule.window);
+                code.insert(code.begin() + i, replacement.begin(), replacement.end());
+                hits[rule.name]++;
+                changed = true;
+                i = i > 0 ? i - 1 : 0;
+                break;
+            }
+        }
+        return changed;
+    }
+
+    static void retarget(std::vector<BasicBlock> &blocks, const std::map<long long, long long> &forward)
+    {
+        auto resolve = [&](long long label)
+        {
+            auto it = forward.find(label);
+            return it == forward.end() ? label : it->second;
+        };
+        for (auto &block : blocks)
+        {
+            block.next = resolve(block.next);
+            for (auto &instr : block.instructions)
+            {
+                instr.target = resolve(instr.target);
+            }
+        }
+    }
+
+    bool threadJumps(std::vector<BasicBlock> &blocks)
+    {
+        std::map<long long, long long> forward;
+        for (size_t i = 1; i < blocks.size(); ++i)
+        {
+            if (blocks[i].instructions.empty() && blocks[i].next != -1 && blocks[i].next != blocks[i].label)
+            {
+                forward[blocks[i].label] = blocks[i].next;
+            }
+        }
+        std::vector<long long> labels;
+        for (const auto &[label, target] : forward)
+        {
+            labels.push_back(label);
+        }
+        for (auto label : labels)
+        {
+            std::set<long long> seen;
+            while (forward.count(label) && seen.insert(label).second)
+            {
+                label = forward.at(label);
+            }
+            forward.erase(label);
+        }
+        for (auto &[label, target] : forward)
+        {
+            while (forward.count(target))
+            {
+                target = forward.at(target);
+            }
+        }
+        if (forward.empty())
+        {
+            return false;
+        }
+
+        retarget(blocks, forward);
+        blocks.erase(std::remove_if(blocks.begin() + 1, blocks.end(), [&](const BasicBlock &block)
+                                    { return forward.count(block.label) > 0; }),
+                     blocks.end());
+        hits["jump-threading"] += forward.size();
+        return true;
+    }
+
+    bool dropRedundantBranches(std::vector<BasicBlock> &blocks)
+    {
+        bool changed = false;
+        for (auto &block : blocks)
+        {
+            if (block.branchTarget() != -1 && block.branchTarget() == block.next)
+            {
+                block.instructions.pop_back();
+                hits["branch-to-fallthrough"]++;
+                changed = true;
+            }
+        }
+        return changed;
+    }
+
+    bool mergeBlocks(ControlFlowGraph &code)
+    {
+        code.buildEdges();
+        auto &blocks = code.getBlocks();
+        auto indices = code.blockIndices();
+        std::vector<bool> merged(blocks.size(), false);
+        bool changed = false;
+        for (size_t i = 0; i < blocks.size(); ++i)
+        {
+            auto &block = blocks[i];
+            while (!merged[i] && block.next != -1 && !block.terminator())
+            {
+                size_t successor = indices.at(block.next);
+                const auto &following = blocks[successor];
+                if (successor == 0 || successor == i || merged[successor] || following.addressTaken || following.predecessors.size() != 1)
+                {
+                    break;
+                }
+                block.instructions.insert(block.instructions.end(), following.instructions.begin(), following.instructions.end());
+                block.keys.insert(block.keys.end(), following.keys.begin(), following.keys.end());
+                block.origins.insert(block.origins.end(), following.origins.begin(), following.origins.end());
+                block.next = following.next;
+                merged[successor] = true;
+                changedBlocks.insert(block.label);
+                hits["block-merge"]++;
+                changed = true;
+            }
+        }
+        if (changed)
+        {
+            size_t kept = 0;
+            for (size_t i = 0; i < blocks.size(); ++i)
+            {
+                if (!merged[i])
+                {
+                    std::swap(blocks[kept++], blocks[i]);
+                }
+            }
+            blocks.erase(blocks.begin() + kept, blocks.end());
+            indices = code.blockIndices();
+        }
+
+        for (auto &block : blocks)
+        {
+            if (block.next == -1 || block.terminator())
+            {
+                continue;
+            }
+            const auto &following = blocks[indices.at(block.next)];
+            if (following.instructions.size() == 1 && following.next == -1 && following.terminator())
+            {
+                block.instructions.push_back(following.instructions.back());
+                block.next = -1;
+                hits["tail-duplication"]++;
+                changed = true;
+            }
+        }
+        return changed;
+    }
+
+public:
+    PeepholeOptimizer() : rules(defaultRules())
+    {
+        auto learned = superoptimizedRules();
+        rules.insert(rules.end(), learned.begin(), learned.end());
+    }
+
+    void addRule(const PeepholeRule &rule)
+    {
+        rules.push_back(rule);
+    }
+
+    static long long staticCost(const std::vector<Instruction> &program)
+    {
+        long long cost = 0;
+        for (const auto &instr : program)
+        {
+            cost += instructionCost(instr.operation);
+        }
+        return cost;
+    }
+
+    void run(ControlFlowGraph &code)
+    {
+        auto before = code.assemble();
+        instructionsBefore = before.size();
+        costBefore = staticCost(before);
+
+        for (const auto &block : code.getBlocks())
+        {
+            changedBlocks.insert(block.label);
+        }
+        bool changed = true;
+        while (changed)
+        {
+            changed = false;
+            learnHotSequences(code);
+            changedBlocks.clear();
+            for (auto &block : code.getBlocks())
+            {
+                if (applyRules(block))
+                {
+                    changedBlocks.insert(block.label);
+                    changed = true;
+                }
+            }
+            changed |= dropRedundantBranches(code.getBlocks());
+            changed |= threadJumps(code.getBlocks());
+            changed |= mergeBlocks(code);
+        }
+
+        auto after = code.assemble();
+        instructionsAfter = after.size();
+        costAfter = staticCost(after);
+    }
+
+    void printStatistics(std::ostream &out) const
+    {
+        out << "peephole: " << instructionsBefore << " -> " << instructionsAfter << " instructions, static cost "
+            << costBefore << " -> " << costAfter << std::endl;
+        out << "superoptimizer: " << superoptimizer->getSearchedWindows() << " sequences searched, "
+            << superoptimizer->getCachedRules() << " rewrite rules cached" << std::endl;
+        for (const auto &[name, count] : hits)
+        {
+            out << "  " << name << ": " << count << std::endl;
+        }
+    }
+};
+
+#endif // PEEPHOLE_HPP
@@ -0,0 +1,92 @@
+#ifndef PROFILE_HPP
+#define PROFILE_HPP
+
+#include <fstream>
+#include <map>
+#include <stdexcept>
+#include <string>
+#include <utility>
+
+class BlockCounts
+{
+public:
+    long long executed = 0;
+    long long taken = 0;
+
+    BlockCounts() = default;
+    BlockCounts(long long executedCount, long long takenCount) : executed(executedCount), taken(takenCount) {}
+};
+
+using BlockKey = std::pair<const void *, long long>;
+
+class Profile
+{
+private:
+    long long programSize = 0;
+    std::map<long long, BlockCounts> instructions;
+    std::map<BlockKey, BlockCounts> blocks;
+    std::map<const void *, long long> nodes;
+
+public:
+    static Profile load(const std::string &path)
+    {
+        std::ifstream in(path);
+        if (!in.is_open())
+        {
+            throw std::runtime_error("Failed to open profile file: " + path);
+        }
+
+        Profile profile;
+        if (!(in >> profile.programSize))
+        {
+            throw std::runtime_error("Malformed profile file: " + path);
+        }
+        long long address, executed, taken;
+        while (in >> address >> executed >> taken)
+        {
+            profile.instructions[address] = BlockCounts(executed, taken);
+        }
+        if (!in.eof())
+        {
+            throw std::runtime_error("Malformed profile file: " + path);
+        }
+        return profile;
+    }
+
+    long long getProgramSize() const
+    {
+        return programSize;
+    }
+
+    BlockCounts instruction(long long address) const
+    {
+        auto it = instructions.find(address);
+        return it == instructions.end() ? BlockCounts() : it->second;
+    }
+
+    void recordBlock(const BlockKey &key, const BlockCounts &counts)
+    {
+        auto &recorded = blocks[key];
+        recorded.executed += counts.executed;
+        recorded.taken += counts.taken;
+    }
+
+    void recordNode(const void *node, long long entries)
+    {
+        nodes[node] += entries;
+    }
+
+    const BlockCounts *block(const BlockKey &key) const
+    {
+        auto it = blocks.find(key);
+        return it == blocks.end() ? nullptr : &it->second;
+    }
+
+    long long entries(const void *node) const
+    {
+        auto it = nodes.find(node);
+        return it == nodes.end() ? 0 : it->second;
+    }
+};
+
+#endif // PROFILE_HPP
@@ -0,0 +1,353 @@
+#ifndef SUPEROPTIMIZER_HPP
+#define SUPEROPTIMIZER_HPP
+
+#include <vector>
+#include <map>
+#include <unordered_map>
+#include <algorithm>
+#include <functional>
+#include <string>
+#include <random>
+
+#include "ControlFlowGraph.hpp"
+
+class SuperoptimizerStep
+{
+public:
+    std::string operation;
+    size_t slot;
+
+    SuperoptimizerStep(const std::string &op, size_t slotIndex) : operation(op), slot(slotIndex) {}
+};
+
+class SuperoptimizerRewrite
+{
+public:
+    bool found = false;
+    std::vector<SuperoptimizerStep> steps;
+};
+
+class Superoptimizer
+{
+private:
+    using Sequence = std::vector<SuperoptimizerStep>;
+    using State = std::vector<long long>;
+    using Term = std::map<long long, long long>;
+    using SymbolicState = std::vector<Term>;
+
+    size_t maxWindow = 4;
+    size_t testCount = 8;
+    std::unordered_map<unsigned long long, SuperoptimizerRewrite> cache;
+    std::map<Term, long long> halves;
+    long long searchedWindows = 0;
+    long long cachedRules = 0;
+
+    static bool eligible(const IrInstruction &instr)
+    {
+        static const std::vector<std::string> operations = {"LOAD", "STORE", "ADD", "SUB", "HALF"};
+        if (instr.target != -1)
+        {
+            return false;
+        }
+        for (const auto &op : operations)
+        {
+            if (instr.operation == op)
+            {
+                return true;
+            }
+        }
+        return false;
+    }
+
+    static long long sequenceCost(const Sequence &sequence)
+    {
+        long long cost = 0;
+        for (const auto &step : sequence)
+        {
+            cost += instructionCost(step.operation);
+        }
+        return cost;
+    }
+
+    static bool canonicalise(const std::vector<IrInstruction> &code, size_t position, size_t window,
+                             Sequence &sequence, std::vector<long long> &addresses)
+    {
+        addresses.assign(1, 0);
+        sequence.clear();
+        for (size_t i = position; i < position + window; ++i)
+        {
+            if (!eligible(code[i]))
+            {
+                return false;
+            }
+            size_t slot = 0;
+            if (code[i].operation != "HALF")
+            {
+                auto it = std::find(addresses.begin(), addresses.end(), code[i].argument);
+                slot = it - addresses.begin();
+                if (it == addresses.end())
+                {
+                    addresses.push_back(code[i].argument);
+                }
+            }
+            sequence.emplace_back(code[i].operation, slot);
+        }
+        return true;
+    }
+
+    static bool accumulatorDeadAfter(const std::vector<IrInstruction> &code, size_t end)
+    {
+        return end < code.size() && (code[end].operation == "SET" || (code[end].operation == "LOAD" && code[end].argument != 0));
+    }
+
+    static unsigned long long opcode(const std::string &operation)
+    {
+        static const std::vector<std::string> operations = {"LOAD", "STORE", "ADD", "SUB", "HALF"};
+        return std::find(operations.begin(), operations.end(), operation) - operations.begin() + 1;
+    }
+
+    static unsigned long long key(const Sequence &sequence, bool deadAccumulator)
+    {
+        unsigned long long packed = 2 + deadAccumulator;
+        for (const auto &step : sequence)
+        {
+            packed = packed << 6 | opcode(step.operation) << 3 | step.slot;
+        }
+        return packed;
+    }
+
+    static void execute(const Sequence &sequence, State &state)
+    {
+        for (const auto &step : sequence)
+        {
+            auto &accumulator = state[0];
+            auto value = state[step.slot];
+            if (step.operation == "LOAD")
+            {
+                accumulator = value;
+            }
+            else if (step.operation == "STORE")
+            {
+                state[step.slot] = accumulator;
+            }
+            else if (step.operation == "ADD")
+            {
+                accumulator = static_cast<long long>(static_cast<unsigned long long>(accumulator) + static_cast<unsigned long long>(value));
+            }
+            else if (step.operation == "SUB")
+            {
+                accumulator = static_cast<long long>(static_cast<unsigned long long>(accumulator) - static_cast<unsigned long long>(value));
+            }
+            else
+            {
+                accumulator >>= 1;
+            }
+        }
+    }
+
+    static Term combine(const Term &a, const Term &b, long long sign)
+    {
+        Term result = a;
+        for (const auto &[atom, coefficient] : b)
+        {
+            if ((result[atom] += sign * coefficient) == 0)
+            {
+                result.erase(atom);
+            }
+        }
+        return result;
+    }
+
+    Term half(const Term &value)
+    {
+        Term result;
+        for (const auto &[atom, coefficient] : value)
+        {
+            if (coefficient % 2 != 0)
+            {
+                auto it = halves.emplace(value, -static_cast<long long>(halves.size()) - 1).first;
+                return Term{{it->second, 1}};
+            }
+            result[atom] = coefficient / 2;
+        }
+        return result;
+    }
+
+    SymbolicState evaluate(const Sequence &sequence, size_t slots)
+    {
+        SymbolicState state(slots);
+        for (size_t slot = 0; slot < slots; ++slot)
+        {
+            state[slot][static_cast<long long>(slot)] = 1;
+        }
+        for (const auto &step : sequence)
+        {
+            if (step.operation == "LOAD")
+            {
+                state[0] = state[step.slot];
+            }
+            else if (step.operation == "STORE")
+            {
+                state[step.slot] = state[0];
+            }
+            else if (step.operation == "ADD" || step.operation == "SUB")
+            {
+                state[0] = combine(state[0], state[step.slot], step.operation == "ADD" ? 1 : -1);
+            }
+            else
+            {
+                state[0] = half(state[0]);
+            }
+        }
+        return state;
+    }
+
+    std::vector<State> testStates(size_t slots) const
+    {
+        std::mt19937_64 random(slots);
+        std::vector<State> states;
+        for (size_t test = 0; test < testCount; ++test)
+        {
+            long long magnitude = 1LL << (test * 5 % 40 + 2);
+            std::uniform_int_distribution<long long> values(-magnitude, magnitude);
+            State state(slots);
+            for (auto &value : state)
+            {
+                value = values(random);
+            }
+            states.push_back(state);
+        }
+        return states;
+    }
+
+    template <typename T>
+    static bool agrees(const std::vector<T> &a, const std::vector<T> &b, bool deadAccumulator)
+    {
+        return std::equal(a.begin() + deadAccumulator, a.end(), b.begin() + deadAccumulator);
+    }
+
+    void search(const Sequence &original, size_t slots, bool deadAccumulator, SuperoptimizerRewrite &rewrite)
+    {
+        static const std::vector<std::string> operations = {"HALF", "LOAD", "STORE", "ADD", "SUB"};
+        auto inputs = testStates(slots);
+        std::vector<State> expected = inputs;
+        for (auto &state : expected)
+        {
+            execute(original, state);
+        }
+        auto reference = evaluate(original, slots);
+
+        long long bestCost = sequenceCost(original);
+        Sequence candidate;
+        std::function<void(long long)> extend = [&](long long cost)
+        {
+            bool passes = true;
+            for (size_t test = 0; passes && test < inputs.size(); ++test)
+            {
+                State state = inputs[test];
+                execute(candidate, state);
+                passes = agrees(state, expected[test], deadAccumulator);
+            }
+            if (passes && agrees(evaluate(candidate, slots), reference, deadAccumulator))
+            {
+                bestCost = cost;
+                rewrite.found = true;
+                rewrite.steps = candidate;
+                return;
+            }
+            if (candidate.size() + 1 >= original.size())
+            {
+                return;
+            }
+            for (const auto &op : operations)
+            {
+                if (cost + instructionCost(op) >= bestCost)
+                {
+                    continue;
+                }
+                for (size_t slot = 0; slot < (op == "HALF" ? 1 : slots); ++slot)
+                {
+                    candidate.emplace_back(op, slot);
+                    extend(cost + instructionCost(op));
+                    candidate.pop_back();
+                }
+            }
+        };
+        extend(0);
+    }
+
+public:
+    void learn(const std::vector<IrInstruction> &code)
+    {
+        Sequence sequence;
+        std::vector<long long> addresses;
+        for (size_t position = 0; position < code.size(); ++position)
+        {
+            for (size_t window = 2; window <= maxWindow && position + window <= code.size(); ++window)
+            {
+                if (!canonicalise(code, position, window, sequence, addresses))
+                {
+                    break;
+                }
+                bool deadAccumulator = accumulatorDeadAfter(code, position + window);
+                auto inserted = cache.emplace(key(sequence, deadAccumulator), SuperoptimizerRewrite());
+                if (!inserted.second)
+                {
+                    continue;
+                }
+                searchedWindows++;
+                search(sequence, addresses.size(), deadAccumulator, inserted.first->second);
+                cachedRules += inserted.first->second.found;
+            }
+        }
+    }
+
+    bool matches(const std::vector<IrInstruction> &code, size_t position, size_t window) const
+    {
+        Sequence sequence;
+        std::vector<long long> addresses;
+        if (position + window > code.size() || !canonicalise(code, position, window, sequence, addresses))
+        {
+            return false;
+        }
+        auto it = cache.find(key(sequence, accumulatorDeadAfter(code, position + window)));
+        return it != cache.end() && it->second.found;
+    }
+
+    std::vector<IrInstruction> rewrite(const std::vector<IrInstruction> &code, size_t position, size_t window) const
+    {
+        Sequence sequence;
+        std::vector<long long> addresses;
+        canonicalise(code, position, window, sequence, addresses);
+        std::vector<IrInstruction> replacement;
+        for (const auto &step : cache.at(key(sequence, accumulatorDeadAfter(code, position + window))).steps)
+        {
+            if (step.operation == "HALF")
+            {
+                replacement.emplace_back("HALF");
+            }
+            else
+            {
+                replacement.emplace_back(step.operation, addresses[step.slot], true);
+            }
+        }
+        return replacement;
+    }
+
+    size_t getMaxWindow() const
+    {
+        return maxWindow;
+    }
+
+    long long getSearchedWindows() const
+    {
+        return searchedWindows;
+    }
+
+    long long getCachedRules() const
+    {
+        return cachedRules;
+    }
+};
+
+#endif // SUPEROPTIMIZER_HPP
@@ -0,0 +1,170 @@
+#ifndef VALUERANGE_HPP
+#define VALUERANGE_HPP
+
+#include <algorithm>
+#include <climits>
+#include <cstdlib>
+
+class ValueRange
+{
+public:
+    long long low = LLONG_MIN;
+    long long high = LLONG_MAX;
+
+    ValueRange() = default;
+    ValueRange(long long lowBound, long long highBound) : low(lowBound), high(highBound) {}
+
+    static ValueRange constant(long long value)
+    {
+        return ValueRange(value, value);
+    }
+
+    static ValueRange bottom()
+    {
+        return ValueRange(LLONG_MAX, LLONG_MIN);
+    }
+
+    bool empty() const
+    {
+        return low > high;
+    }
+
+    bool bounded() const
+    {
+        return !empty() && low != LLONG_MIN && high != LLONG_MAX;
+    }
+
+    bool nonNegative() const
+    {
+        return !empty() && low >= 0;
+    }
+
+    bool excludesZero() const
+    {
+        return !empty() && (low > 0 || high < 0);
+    }
+
+    ValueRange hull(const ValueRange &other) const
+    {
+        if (empty() || other.empty())
+        {
+            return empty() ? other : *this;
+        }
+        return ValueRange(std::min(low, other.low), std::max(high, other.high));
+    }
+
+    ValueRange intersect(const ValueRange &other) const
+    {
+        ValueRange result(std::max(low, other.low), std::min(high, other.high));
+        return empty() || other.empty() || result.empty() ? bottom() : result;
+    }
+
+    static long long saturate(__int128 value)
+    {
+        if (value <= LLONG_MIN)
+        {
+            return LLONG_MIN;
+        }
+        if (value >= LLONG_MAX)
+        {
+            return LLONG_MAX;
+        }
+        return static_cast<long long>(value);
+    }
+
+    static long long lowSum(long long a, long long b)
+    {
+        return a == LLONG_MIN || b == LLONG_MIN ? LLONG_MIN : saturate(static_cast<__int128>(a) + b);
+    }
+
+    static long long highSum(long long a, long long b)
+    {
+        return a == LLONG_MAX || b == LLONG_MAX ? LLONG_MAX : saturate(static_cast<__int128>(a) + b);
+    }
+
+    static ValueRange add(const ValueRange &a, const ValueRange &b)
+    {
+        if (a.empty() || b.empty())
+        {
+            return bottom();
+        }
+        return ValueRange(lowSum(a.low, b.low), highSum(a.high, b.high));
+    }
+
+    static ValueRange subtract(const ValueRange &a, const ValueRange &b)
+    {
+        if (a.empty() || b.empty())
+        {
+            return bottom();
+        }
+        long long negatedLow = b.high == LLONG_MAX ? LLONG_MIN : -b.high;
+        long long negatedHigh = b.low == LLONG_MIN ? LLONG_MAX : -b.low;
+        return ValueRange(lowSum(a.low, negatedLow), highSum(a.high, negatedHigh));
+    }
+
+    static ValueRange multiply(const ValueRange &a, const ValueRange &b)
+    {
+        if (a.empty() || b.empty())
+        {
+            return bottom();
+        }
+        if (a.nonNegative() && b.nonNegative())
+        {
+            if (!a.bounded() || !b.bounded())
+            {
+                return ValueRange(saturate(static_cast<__int128>(a.low) * b.low), LLONG_MAX);
+            }
+        }
+        else if (!a.bounded() || !b.bounded())
+        {
+            return ValueRange();
+        }
+        __int128 corners[] = {static_cast<__int128>(a.low) * b.low, static_cast<__int128>(a.low) * b.high,
+                              static_cast<__int128>(a.high) * b.low, static_cast<__int128>(a.high) * b.high};
+        return ValueRange(saturate(*std::min_element(corners, corners + 4)), saturate(*std::max_element(corners, corners + 4)));
+    }
+
+    static ValueRange divide(const ValueRange &a, const ValueRange &b)
+    {
+        if (a.empty() || b.empty())
+        {
+            return bottom();
+        }
+        if (a.nonNegative() && b.nonNegative())
+        {
+            bool zeroDivisor = b.low <= 0 && b.high >= 0;
+            return ValueRange(zeroDivisor || b.high <= 0 || b.high == LLONG_MAX ? 0 : a.low / b.high, a.high);
+        }
+        if (a.bounded())
+        {
+            long long magnitude = std::max(std::llabs(a.low), std::llabs(a.high));
+            return ValueRange(-magnitude, magnitude);
+        }
+        return ValueRange();
+    }
+
+    static ValueRange modulo(const ValueRange &a, const ValueRange &b)
+    {
+        if (a.empty() || b.empty())
+        {
+            return bottom();
+        }
+        if (b.nonNegative())
+        {
+            long long limit = b.high == LLONG_MAX ? LLONG_MAX : std::max(b.high - 1, 0LL);
+            return ValueRange(0, a.nonNegative() ? std::min(limit, a.high) : limit);
+        }
+        if (b.high <= 0)
+        {
+            return ValueRange(b.low == LLONG_MIN ? LLONG_MIN : std::min(b.low + 1, 0LL), 0);
+        }
+        if (b.bounded())
+        {
+            long long limit = std::max(std::llabs(b.low), std::llabs(b.high));
+            return ValueRange(-limit, limit);
+        }
+        return ValueRange();
+    }
+};
+
+#endif // VALUERANGE_HPP
@@ -0,0 +1,32 @@
+/*
+ * Koszty instrukcji maszyny wirtualnej do projektu z JFTT2024
+ *
+ * Tablica jest wspólna dla maszyny wirtualnej i kompilatora,
+ * indeksowana wartościami typu Instructions.
+*/
+#pragma once
+
+#include "instructions.hh"
+
+const long long instruction_cost[] = {
+  100,	// GET
+  100,	// PUT
+  10,	// LOAD
+  10,	// STORE
+  20,	// LOADI
+  20,	// STOREI
+  10,	// ADD
+  10,	// SUB
+  20,	// ADDI
+  12,	// SUBI
+  50,	// SET
+  5,	// HALF
+  1,	// JUMP
+  1,	// JPOS
+  1,	// JZERO
+  1,	// JNEG
+  10,	// RTRN
+  0	// HALT
+};
+
+const char * const instruction_name[] = { "GET", "PUT", "LOAD", "STORE", "LOADI", "STOREI", "ADD", "SUB", "ADDI", "SUBI", "SET", "HALF", "JUMP", "JPOS", "JZERO", "JNEG", "RTRN", "HALT" };
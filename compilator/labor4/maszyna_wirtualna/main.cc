@@ -15,16 +15,16 @@
 using namespace std;
 
 extern void run_parser( vector< pair<int,long long> > & program, FILE * data );
-extern void run_machine( vector< pair<int,long long> > & program );
+extern void run_machine( vector< pair<int,long long> > & program, char const * profile );
 
 int main( int argc, char const * argv[] )
 {
   vector< pair<int,long long> > program;
   FILE * data;
 
-  if( argc!=2 )
+  if( argc!=2 && argc!=3 )
   {
-    cerr << cRed << "Sposób użycia programu: interpreter kod" << cReset << endl;
+    cerr << cRed << "Sposób użycia programu: interpreter kod [profil]" << cReset << endl;
     return -1;
   }
 
@@ -39,7 +39,7 @@ int main( int argc, char const * argv[] )
 
   fclose( data );
 
-  run_machine( program );
+  run_machine( program, argc==3 ? argv[2] : nullptr );
 
   return 0;
 }
@@ -7,6 +7,7 @@
  * (wersja long long)
 */
 #include <iostream>
+#include <fstream>
 #include <locale>
 
 #include <utility>
@@ -17,11 +18,12 @@
 #include <ctime>
 
 #include "instructions.hh"
+#include "costs.hh"
 #include "colors.hh"
 
 using namespace std;
 
-void run_machine( vector< pair<int,long long> > & program )
+void run_machine( vector< pair<int,long long> > & program, char const * profile )
 {
   map<long long,long long> p;
 
@@ -29,6 +31,9 @@ void run_machine( vector< pair<int,long long> > & program )
 
   long long t, io;
 
+  vector<long long> executed( program.size(), 0 );
+  vector<long long> taken( program.size(), 0 );
+
   cout << cBlue << "Uruchamianie programu." << cReset << endl;
   lr = 0;
   t = 0;
@@ -45,30 +50,32 @@ void run_machine( vector< pair<int,long long> > & program )
          cerr << cRed << "Błąd: ujemny adres pamięci." << cReset << endl;
          exit(-1);
      }
+     executed[lr]++;
+     t += instruction_cost[ program[lr].first ];
      switch( program[lr].first )
      {
-      case GET:	cout << "? "; cin >> p[program[lr].second]; io+=100; t+=100; lr++; break;
-      case PUT:	cout << "> " << p[program[lr].second] << endl; io+=100; t+=100; lr++; break;
+      case GET:	cout << "? "; cin >> p[program[lr].second]; io+=100; lr++; break;
+      case PUT:	cout << "> " << p[program[lr].second] << endl; io+=100; lr++; break;
 
-      case LOAD:	p[0] = p[program[lr].second]; t+=10; lr++; break;
-      case STORE:	p[program[lr].second] = p[0]; t+=10; lr++; break;
-      case LOADI:	p[0] = p[p[program[lr].second]]; t+=20; lr++; break;
-      case STOREI:	p[p[program[lr].second]] = p[0]; t+=20; lr++; break;
+      case LOAD:	p[0] = p[program[lr].second]; lr++; break;
+      case STORE:	p[program[lr].second] = p[0]; lr++; break;
+      case LOADI:	p[0] = p[p[program[lr].second]]; lr++; break;
+      case STOREI:	p[p[program[lr].second]] = p[0]; lr++; break;
 
-      case ADD:	        p[0] += p[program[lr].second]; t+=10; lr++; break;
-      case SUB:	        p[0] -= p[program[lr].second]; t+=10; lr++; break;
-      case ADDI:        p[0] += p[p[program[lr].second]]; t+=20; lr++; break;
-      case SUBI:        p[0] -= p[p[program[lr].second]]; t+=12; lr++; break;
+      case ADD:	        p[0] += p[program[lr].second]; lr++; break;
+      case SUB:	        p[0] -= p[program[lr].second]; lr++; break;
+      case ADDI:        p[0] += p[p[program[lr].second]]; lr++; break;
+      case SUBI:        p[0] -= p[p[program[lr].second]]; lr++; break;
 
-      case SET:	        p[0] = program[lr].second; t+=50; lr++; break;
-      case HALF:	p[0] >>= 1; t+=5; lr++; break;
+      case SET:	        p[0] = program[lr].second; lr++; break;
+      case HALF:	p[0] >>= 1; lr++; break;
 
-      case JUMP: 	lr += program[lr].second; t+=1; break;
-      case JPOS:	if( p[0]>0 ) lr += program[lr].second; else lr++; t+=1; break;
-      case JZERO:	if( p[0]==0 ) lr += program[lr].second; else lr++; t+=1; break;
-      case JNEG:	if( p[0]<0 ) lr += program[lr].second; else lr++; t+=1; break;
+      case JUMP: 	lr += program[lr].second; break;
+      case JPOS:	if( p[0]>0 ) { taken[lr]++; lr += program[lr].second; } else lr++; break;
+      case JZERO:	if( p[0]==0 ) { taken[lr]++; lr += program[lr].second; } else lr++; break;
+      case JNEG:	if( p[0]<0 ) { taken[lr]++; lr += program[lr].second; } else lr++; break;
 
-      case RTRN: 	lr = p[program[lr].second]; t+=10; break;
+      case RTRN: 	lr = p[program[lr].second]; break;
       default: break;
     }
     if( lr<0 || lr>=(int)program.size() )
@@ -77,6 +84,19 @@ void run_machine( vector< pair<int,long long> > & program )
       exit(-1);
     }
   }
+  if( profile )
+  {
+    ofstream out( profile );
+    if( !out )
+    {
+      cerr << cRed << "Błąd: Nie można zapisać profilu do pliku " << profile << cReset << endl;
+      exit(-1);
+    }
+    out << program.size() << endl;
+    for( size_t i=0; i<program.size(); i++ )
+      if( executed[i]>0 )
+        out << i << " " << executed[i] << " " << taken[i] << endl;
+  }
   cout.imbue(std::locale(""));
   cout << cBlue << "Skończono program (koszt: " << cRed << t << cBlue << "; w tym i/o: " << io << ")." << cReset << endl;
 }
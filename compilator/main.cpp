@@ -1,8 +1,10 @@
 #include <iostream>
 #include <fstream>
 #include <cstdio>
+#include <string>
 #include "AstNode.hpp"
 #include "CodeGenerator.hpp"
+#include "Profile.hpp"
 
 extern FILE* yyin;
 extern int yyparse();
@@ -10,8 +12,20 @@ extern int yydebug;
 extern ProgramNode* root;
 
 int main(int argc, char** argv) {
-    if (argc != 3) {
-        std::cerr << "Usage: " << argv[0] << " <input_file> <output_file>" << std::endl;
+    bool showStatistics = false;
+    const char* profilePath = nullptr;
+    bool validArguments = argc >= 3;
+    for (int i = 3; i < argc && validArguments; i++) {
+        if (std::string(argv[i]) == "--stats") {
+            showStatistics = true;
+        } else if (std::string(argv[i]) == "--profile" && i + 1 < argc) {
+            profilePath = argv[++i];
+        } else {
+            validArguments = false;
+        }
+    }
+    if (!validArguments) {
+        std::cerr << "Usage: " << argv[0] << " <input_file> <output_file> [--stats] [--profile <profile_file>]" << std::endl;
         return 1;
     }
 
@@ -27,7 +41,15 @@ int main(int argc, char** argv) {
 
         if (root) {
             try {
-                CodeGenerator generator;
+                Profile profile;
+                if (profilePath) {
+                    profile = Profile::load(profilePath);
+                    CodeGenerator baseline;
+                    baseline.generateProgram(root);
+                    baseline.attributeProfile(profile);
+                }
+
+                CodeGenerator generator(profilePath ? &profile : nullptr);
                 generator.generateProgram(root);
                 
                 std::ofstream outFile(argv[2]);
@@ -46,6 +68,9 @@ int main(int argc, char** argv) {
                 outFile.close();
 
                 std::cout << "Code generation completed successfully." << std::endl;
+                if (showStatistics) {
+                    generator.printStatistics(std::cout);
+                }
 
             } catch (const std::runtime_error& e) {
                 std::cerr << e.what() << std::endl;